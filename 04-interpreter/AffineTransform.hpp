@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// x' = A * x + b over a fixed set of variables.
+// Everything is computed in uint64, which is arithmetic modulo 2^64 and therefore exactly
+// what the Wrapping* helpers do to int64 values, no matter how many times the transform is applied
+struct AffineTransform final {
+  // Coefficients of every variable followed by the constant term
+  using Row = std::vector<uint64_t>;
+
+  explicit AffineTransform(size_t size)
+  : m_rows(size, Row(size + 1, 0)) {
+    for (size_t i = 0; i < size; ++i) {
+      m_rows[i][i] = 1;
+    }
+  }
+
+  [[nodiscard]] size_t GetSize() const {
+    return m_rows.size();
+  }
+
+  [[nodiscard]] Row& GetRow(size_t variable) {
+    return m_rows[variable];
+  }
+
+  [[nodiscard]] const Row& GetRow(size_t variable) const {
+    return m_rows[variable];
+  }
+
+  [[nodiscard]] Row MakeConstant(int64_t value) const {
+    Row row(GetSize() + 1, 0);
+    row.back() = static_cast<uint64_t>(value);
+    return row;
+  }
+
+  // this, then next
+  [[nodiscard]] AffineTransform Then(const AffineTransform& next) const {
+    size_t size = GetSize();
+    AffineTransform result(size);
+    for (size_t i = 0; i < size; ++i) {
+      Row& row = result.m_rows[i];
+      row.assign(size + 1, 0);
+      row.back() = next.m_rows[i].back();
+      for (size_t j = 0; j < size; ++j) {
+        uint64_t coefficient = next.m_rows[i][j];
+        if (coefficient == 0) {
+          continue;
+        }
+
+        for (size_t k = 0; k <= size; ++k) {
+          row[k] += coefficient * m_rows[j][k];
+        }
+      }
+    }
+
+    return result;
+  }
+
+  // Square-and-multiply, O(size^3 * log(exponent))
+  [[nodiscard]] AffineTransform Power(uint64_t exponent) const {
+    AffineTransform result(GetSize());
+    AffineTransform base = *this;
+    while (exponent > 0) {
+      if (exponent & 1) {
+        result = result.Then(base);
+      }
+
+      exponent >>= 1;
+      if (exponent > 0) {
+        base = base.Then(base);
+      }
+    }
+
+    return result;
+  }
+
+  void Apply(std::vector<int64_t>& values) const {
+    size_t size = GetSize();
+    std::vector<int64_t> result(size);
+    for (size_t i = 0; i < size; ++i) {
+      uint64_t value = m_rows[i].back();
+      for (size_t j = 0; j < size; ++j) {
+        value += m_rows[i][j] * static_cast<uint64_t>(values[j]);
+      }
+
+      result[i] = static_cast<int64_t>(value);
+    }
+
+    values = std::move(result);
+  }
+
+private:
+  std::vector<Row> m_rows;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// int64 arithmetic that wraps around instead of overflowing into UB.
+// Every backend goes through these, so all of them agree on overflowed values
+
+inline int64_t WrappingAdd(int64_t left, int64_t right) {
+  return static_cast<int64_t>(static_cast<uint64_t>(left) + static_cast<uint64_t>(right));
+}
+
+inline int64_t WrappingSubtract(int64_t left, int64_t right) {
+  return static_cast<int64_t>(static_cast<uint64_t>(left) - static_cast<uint64_t>(right));
+}
+
+inline int64_t WrappingMultiply(int64_t left, int64_t right) {
+  return static_cast<int64_t>(static_cast<uint64_t>(left) * static_cast<uint64_t>(right));
+}
@@ -1,7 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
+
+#include "SourcePosition.hpp"
 /*
 
 Nodes:
@@ -22,6 +26,12 @@ AstNodeStatementDelete: (string Identifier)
 
 AstNodeValue: (Type, int Number / string Identifier)
 
+Produced by Optimizer only:
+
+AstNodeStatementAffineLoop: (AstNodeStatementLoop Loop, vector<string> Variables)
+AstNodeStatementAffineModification: (string Target, string Source, int Multiplier, int Addend)
+AstNodeStatementCheckFunction: (string Identifier)
+
 
 
 EvaluateValue() -> number
@@ -47,6 +57,9 @@ enum struct AstNodeType : uint32_t {
   STATEMENT_CONDITION,//
   STATEMENT_LOOP,//
   STATEMENT_CHAIN,
+  STATEMENT_AFFINE_LOOP,
+  STATEMENT_AFFINE_MODIFICATION,
+  STATEMENT_CHECK_FUNCTION,
 
   COUNT
 };
@@ -76,11 +89,25 @@ struct AstNode {
     return m_type;
   }
 
+  template <typename T>
+  [[nodiscard]] T* As() requires(std::derived_from<T, AstNode>) {
+    return dynamic_cast<T*>(this);
+  }
+
   template <typename T>
   [[nodiscard]] const T* As() const requires(std::derived_from<T, AstNode>) {
     return dynamic_cast<const T*>(this);
   }
 
+  // Set by Parser for statements
+  [[nodiscard]] SourcePosition GetSourcePosition() const {
+    return m_position;
+  }
+
+  void SetSourcePosition(SourcePosition position) {
+    m_position = position;
+  }
+
 protected:
   explicit AstNode(AstNodeType type)
   : m_type(type) {
@@ -88,6 +115,7 @@ protected:
 
 private:
   AstNodeType m_type;
+  SourcePosition m_position;
 };
 
 struct AstNodeValueNumber final : AstNode {
@@ -122,8 +150,18 @@ struct AstNodeValueIdentifier final : AstNode {
     return m_name;
   }
 
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
 private:
   std::string m_name;
+  uint32_t m_slot = UINT32_MAX;
 };
 
 struct AstNodeBinaryOperator final : AstNode {
@@ -180,8 +218,18 @@ struct AstNodeStatementDelete final : AstNode {
     return m_variableName;
   }
 
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
 private:
   std::string m_variableName;
+  uint32_t m_slot = UINT32_MAX;
 };
 
 struct AstNodeStatementCall final : AstNode {
@@ -198,8 +246,18 @@ struct AstNodeStatementCall final : AstNode {
     return m_functionName;
   }
 
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
 private:
   std::string m_functionName;
+  uint32_t m_slot = UINT32_MAX;
 };
 
 struct AstNodeBinaryStatementVarModification final : AstNode {
@@ -226,10 +284,20 @@ struct AstNodeBinaryStatementVarModification final : AstNode {
     return m_value;
   }
 
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
 private:
   ModificationOperatorType m_type;
   std::string m_varName;
   std::shared_ptr<AstNode> m_value;
+  uint32_t m_slot = UINT32_MAX;
 };
 
 struct AstNodeStatementFunctionDeclaration final : AstNode {
@@ -251,9 +319,31 @@ struct AstNodeStatementFunctionDeclaration final : AstNode {
     return m_code;
   }
 
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
+  // The code as compile(GetCode()) made it on the first call, e.g. optimized by FunctionCompiler.
+  // Cached for every later call from any thread, the tree is meant for one such compile function
+  template <typename Compile>
+  [[nodiscard]] const AstNode* GetCompiledCode(Compile compile) const {
+    std::call_once(m_compileOnce, [this, &compile] {
+      m_compiledCode = compile(m_code);
+    });
+    return m_compiledCode.get();
+  }
+
 private:
   std::string m_functionName;
   std::shared_ptr<AstNode> m_code;
+  uint32_t m_slot = UINT32_MAX;
+  mutable std::once_flag m_compileOnce;
+  mutable std::shared_ptr<AstNode> m_compiledCode;
 };
 
 struct AstNodeStatementCondition final : AstNode {
@@ -321,3 +411,135 @@ struct AstNodeStatementChain final : AstNode {
 private:
   std::vector<std::shared_ptr<AstNode>> m_statements;
 };
+
+// Loop whose body only does add/sub/mult/= on Variables, see Optimizer. Backends that
+// don't evaluate it in closed form can run GetLoop() instead
+struct AstNodeStatementAffineLoop final : AstNode {
+  explicit AstNodeStatementAffineLoop(std::shared_ptr<AstNodeStatementLoop> loop, std::vector<std::string> variableNames)
+  : AstNode(GetType())
+  , m_loop(std::move(loop))
+  , m_variableNames(std::move(variableNames)) {
+  }
+
+  static AstNodeType GetType() {
+    return AstNodeType::STATEMENT_AFFINE_LOOP;
+  }
+
+  [[nodiscard]] std::shared_ptr<AstNodeStatementLoop> GetLoop() const {
+    return m_loop;
+  }
+
+  // Variables the body modifies, in the order of first modification
+  [[nodiscard]] const std::vector<std::string>& GetVariableNames() const {
+    return m_variableNames;
+  }
+
+  // Assigned by Resolver
+  [[nodiscard]] const std::vector<uint32_t>& GetSlots() const {
+    return m_slots;
+  }
+
+  void SetSlots(std::vector<uint32_t> slots) {
+    m_slots = std::move(slots);
+  }
+
+private:
+  std::shared_ptr<AstNodeStatementLoop> m_loop;
+  std::vector<std::string> m_variableNames;
+  std::vector<uint32_t> m_slots;
+};
+
+// target = multiplier * $source + addend, or just addend without a source. Stands for several
+// fused modifications, see Optimizer. Fails if the source is undefined, or the target is
+// undefined and requiresTarget is set. Otherwise assigns (declaring the target if needed)
+struct AstNodeStatementAffineModification final : AstNode {
+  explicit AstNodeStatementAffineModification(std::string targetName, bool requiresTarget, std::string sourceName, int64_t multiplier, int64_t addend)
+  : AstNode(GetType())
+  , m_targetName(std::move(targetName))
+  , m_requiresTarget(requiresTarget)
+  , m_sourceName(std::move(sourceName))
+  , m_multiplier(multiplier)
+  , m_addend(addend) {
+  }
+
+  static AstNodeType GetType() {
+    return AstNodeType::STATEMENT_AFFINE_MODIFICATION;
+  }
+
+  [[nodiscard]] const std::string& GetTargetName() const {
+    return m_targetName;
+  }
+
+  [[nodiscard]] bool RequiresTarget() const {
+    return m_requiresTarget;
+  }
+
+  [[nodiscard]] bool HasSource() const {
+    return !m_sourceName.empty();
+  }
+
+  [[nodiscard]] const std::string& GetSourceName() const {
+    return m_sourceName;
+  }
+
+  [[nodiscard]] int64_t GetMultiplier() const {
+    return m_multiplier;
+  }
+
+  [[nodiscard]] int64_t GetAddend() const {
+    return m_addend;
+  }
+
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetTargetSlot() const {
+    return m_targetSlot;
+  }
+
+  [[nodiscard]] uint32_t GetSourceSlot() const {
+    return m_sourceSlot;
+  }
+
+  void SetSlots(uint32_t targetSlot, uint32_t sourceSlot) {
+    m_targetSlot = targetSlot;
+    m_sourceSlot = sourceSlot;
+  }
+
+private:
+  std::string m_targetName;
+  bool m_requiresTarget;
+  std::string m_sourceName;
+  int64_t m_multiplier;
+  int64_t m_addend;
+  uint32_t m_targetSlot = UINT32_MAX;
+  uint32_t m_sourceSlot = UINT32_MAX;
+};
+
+// Fails with "Undefined function." if the function isn't declared yet, does nothing otherwise.
+// Stands in front of a call body the Optimizer inlined
+struct AstNodeStatementCheckFunction final : AstNode {
+  explicit AstNodeStatementCheckFunction(std::string functionName)
+  : AstNode(GetType())
+  , m_functionName(std::move(functionName)) {
+  }
+
+  static AstNodeType GetType() {
+    return AstNodeType::STATEMENT_CHECK_FUNCTION;
+  }
+
+  [[nodiscard]] const std::string& GetFunctionName() const {
+    return m_functionName;
+  }
+
+  // Assigned by Resolver
+  [[nodiscard]] uint32_t GetSlot() const {
+    return m_slot;
+  }
+
+  void SetSlot(uint32_t slot) {
+    m_slot = slot;
+  }
+
+private:
+  std::string m_functionName;
+  uint32_t m_slot = UINT32_MAX;
+};
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Arithmetic.hpp"
+#include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "LaneKernels.hpp"
+#include "OutputSink.hpp"
+#include "SymbolTable.hpp"
+
+/*
+
+Lockstep execution of one program over many environments
+
+Every lane is an independent run of the same resolved tree with its own variables. A variable
+is a row of int64 lanes, so a statement is one masked vector operation for all lanes that
+reach it instead of one tree walk per environment. Conditions produce masks, loops keep a
+counter per lane and iterate while any lane has iterations left, and a call runs every
+distinct body bound in the active lanes once, with the lanes bound to it.
+
+A lane that fails or prints drops out of every mask and keeps its output. Print order is per
+lane too: a declaration stamps the variable with the lane's next sequence number.
+
+*/
+
+struct BatchResult final {
+  // Whatever print printed
+  std::string output;
+  // Empty unless the run failed
+  std::string error;
+};
+
+// Slots are the ones Resolver assigned, root has to be resolved against the same tables
+struct BatchInterpreter final {
+  // -1 for lanes that take part, 0 otherwise
+  using Mask = std::vector<int64_t>;
+
+  explicit BatchInterpreter(const SymbolTable& variables, const SymbolTable& functions, size_t laneCount)
+  : m_variableNames(variables)
+  , m_laneCount(laneCount)
+  , m_values(variables.GetSize() * laneCount, 0)
+  , m_stamps(variables.GetSize() * laneCount, 0)
+  , m_nextStamps(laneCount, 1)
+  , m_functions(functions.GetSize() * laneCount, nullptr)
+  , m_running(laneCount, -1)
+  , m_results(laneCount) {
+  }
+
+  [[nodiscard]] size_t GetLaneCount() const {
+    return m_laneCount;
+  }
+
+  // Declares a variable in one lane before the run, in print order
+  void Define(size_t lane, uint32_t slot, int64_t value) {
+    uint64_t& stamp = GetStamps(slot)[lane];
+    if (!stamp) {
+      stamp = m_nextStamps[lane]++;
+    }
+
+    GetValues(slot)[lane] = value;
+  }
+
+  void Evaluate(const AstNode* root) noexcept(false) {
+    Mask mask = m_running;
+    ExecuteStatement(root, mask);
+  }
+
+  [[nodiscard]] const std::vector<BatchResult>& GetResults() const {
+    return m_results;
+  }
+
+private:
+  int64_t* GetValues(uint32_t slot) {
+    return m_values.data() + slot * m_laneCount;
+  }
+
+  uint64_t* GetStamps(uint32_t slot) {
+    return m_stamps.data() + slot * m_laneCount;
+  }
+
+  const AstNodeStatementChain** GetBindings(uint32_t slot) {
+    return m_functions.data() + slot * m_laneCount;
+  }
+
+  static bool IsAnySet(const Mask& mask) {
+    return std::any_of(mask.begin(), mask.end(), [](int64_t lane) {
+      return lane != 0;
+    });
+  }
+
+  void Fail(size_t lane, const char* message) {
+    m_results[lane].error = message;
+    m_running[lane] = 0;
+  }
+
+  // Masked lanes where the slot is undefined fail and leave the mask
+  void RequireDefined(uint32_t slot, Mask& mask) {
+    const uint64_t* stamps = GetStamps(slot);
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      if (mask[i] && !stamps[i]) {
+        Fail(i, "Undefined variable.");
+        mask[i] = 0;
+      }
+    }
+  }
+
+  // Appends the slot to the print order of masked lanes where it is undefined
+  void Declare(uint32_t slot, const Mask& mask) {
+    uint64_t* stamps = GetStamps(slot);
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      if (mask[i] && !stamps[i]) {
+        stamps[i] = m_nextStamps[i]++;
+      }
+    }
+  }
+
+  // Lanes of a value, constants are broadcast into storage
+  const int64_t* LoadValue(const AstNode* node, Mask& mask, std::vector<int64_t>& storage) {
+    if (node->GetType() == AstNodeType::VALUE_NUMBER) {
+      storage.assign(m_laneCount, node->As<AstNodeValueNumber>()->GetValue());
+      return storage.data();
+    }
+
+    if (node->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      uint32_t slot = node->As<AstNodeValueIdentifier>()->GetSlot();
+      RequireDefined(slot, mask);
+      return GetValues(slot);
+    }
+
+    throw ExecutionException("Unexpected node type.");
+  }
+
+  // Masked lanes where the condition holds. A lane only evaluates the right side of and/or
+  // if the left side didn't decide it, same as EvaluateExpression
+  Mask EvaluateCondition(const AstNode* node, Mask mask) {
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    if (!opNode) {
+      throw ExecutionException("Unexpected node type.");
+    }
+
+    switch (opNode->GetOperatorType()) {
+      case BinaryOperatorType::EQUALS:
+      case BinaryOperatorType::NOT_EQUALS: {
+        std::vector<int64_t> leftStorage;
+        std::vector<int64_t> rightStorage;
+        const int64_t* left = LoadValue(opNode->GetLeft().get(), mask, leftStorage);
+        const int64_t* right = LoadValue(opNode->GetRight().get(), mask, rightStorage);
+        Mask result(m_laneCount);
+        MaskedCompare(opNode->GetOperatorType() == BinaryOperatorType::EQUALS, left, right, mask.data(), result.data(), m_laneCount);
+        return result;
+      }
+      case BinaryOperatorType::OR: {
+        Mask result = EvaluateCondition(opNode->GetLeft().get(), mask);
+        for (size_t i = 0; i < m_laneCount; ++i) {
+          mask[i] &= m_running[i] & ~result[i];
+        }
+
+        Mask right = EvaluateCondition(opNode->GetRight().get(), std::move(mask));
+        for (size_t i = 0; i < m_laneCount; ++i) {
+          result[i] |= right[i];
+        }
+
+        return result;
+      }
+      case BinaryOperatorType::AND: {
+        return EvaluateCondition(opNode->GetRight().get(), EvaluateCondition(opNode->GetLeft().get(), std::move(mask)));
+      }
+      default: throw ExecutionException("Unexpected node type.");
+    }
+  }
+
+  void ExecuteStatementChain(const AstNodeStatementChain* node, Mask& mask) {
+    for (const auto& statement : node->GetStatements()) {
+      for (size_t i = 0; i < m_laneCount; ++i) {
+        mask[i] &= m_running[i];
+      }
+
+      if (!IsAnySet(mask)) {
+        return;
+      }
+
+      ExecuteStatement(statement.get(), mask);
+    }
+  }
+
+  void ExecuteStatementPrint(Mask& mask) {
+    for (size_t lane = 0; lane < m_laneCount; ++lane) {
+      if (!mask[lane]) {
+        continue;
+      }
+
+      std::vector<std::pair<uint64_t, uint32_t>> defined;
+      for (uint32_t slot = 0; slot < m_variableNames.GetSize(); ++slot) {
+        if (uint64_t stamp = GetStamps(slot)[lane]) {
+          defined.emplace_back(stamp, slot);
+        }
+      }
+
+      std::sort(defined.begin(), defined.end());
+      OutputSink output = OutputSink::ToString(m_results[lane].output);
+      for (auto [stamp, slot] : defined) {
+        output.WriteVariable(m_variableNames.GetName(slot), GetValues(slot)[lane]);
+      }
+
+      // Print terminates the run
+      m_running[lane] = 0;
+      mask[lane] = 0;
+    }
+  }
+
+  void ExecuteStatementDelete(const AstNodeStatementDelete* node, Mask& mask) {
+    RequireDefined(node->GetSlot(), mask);
+    uint64_t* stamps = GetStamps(node->GetSlot());
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      if (mask[i]) {
+        stamps[i] = 0;
+      }
+    }
+  }
+
+  void ExecuteStatementCall(const AstNodeStatementCall* node, Mask& mask) {
+    ExecuteStatementCheckFunction(node->GetSlot(), mask);
+    const AstNodeStatementChain** bindings = GetBindings(node->GetSlot());
+    Mask pending = mask;
+    for (size_t first = 0; first < m_laneCount; ++first) {
+      if (!pending[first]) {
+        continue;
+      }
+
+      // Lanes are independent, so every body can run for all of its lanes at once
+      const AstNodeStatementChain* body = bindings[first];
+      Mask lanes(m_laneCount, 0);
+      for (size_t i = first; i < m_laneCount; ++i) {
+        if (pending[i] && bindings[i] == body) {
+          lanes[i] = -1;
+          pending[i] = 0;
+        }
+      }
+
+      ExecuteStatementChain(body, lanes);
+    }
+  }
+
+  void ExecuteStatementCheckFunction(uint32_t slot, Mask& mask) {
+    const AstNodeStatementChain** bindings = GetBindings(slot);
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      if (mask[i] && !bindings[i]) {
+        Fail(i, "Undefined function.");
+        mask[i] = 0;
+      }
+    }
+  }
+
+  void ExecuteStatementVariableModification(const AstNodeBinaryStatementVarModification* node, Mask& mask) {
+    ModificationOperatorType opType = node->GetOperatorType();
+    if (static_cast<uint32_t>(opType) >= static_cast<uint32_t>(ModificationOperatorType::COUNT)) {
+      throw ExecutionException("Unexpected node.");
+    }
+
+    uint32_t slot = node->GetSlot();
+    std::vector<int64_t> storage;
+    const int64_t* value = LoadValue(node->GetValue().get(), mask, storage);
+    if (opType == ModificationOperatorType::ASSIGN) {
+      Declare(slot, mask);
+    } else {
+      RequireDefined(slot, mask);
+    }
+
+    MaskedModify(opType, GetValues(slot), value, mask.data(), m_laneCount);
+  }
+
+  void ExecuteStatementFunctionDeclaration(const AstNodeStatementFunctionDeclaration* node, Mask& mask) {
+    const auto* body = node->GetCode()->As<AstNodeStatementChain>();
+    if (!body) {
+      throw ExecutionException("Unexpected node.");
+    }
+
+    const AstNodeStatementChain** bindings = GetBindings(node->GetSlot());
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      if (!mask[i]) {
+        continue;
+      }
+
+      if (bindings[i]) {
+        Fail(i, "Function is already defined.");
+        mask[i] = 0;
+        continue;
+      }
+
+      bindings[i] = body;
+    }
+  }
+
+  void ExecuteStatementLoop(const AstNodeStatementLoop* node, Mask& mask) {
+    // Evaluated once, the body may change the variable
+    std::vector<int64_t> storage;
+    const int64_t* count = LoadValue(node->GetInitValue().get(), mask, storage);
+    std::vector<int64_t> counters(count, count + m_laneCount);
+    Mask iteration(m_laneCount);
+    for (size_t i = 0; i < m_laneCount; ++i) {
+      iteration[i] = mask[i] && counters[i] > 0 ? -1 : 0;
+    }
+
+    while (IsAnySet(iteration)) {
+      Mask body = iteration;
+      ExecuteStatement(node->GetCode().get(), body);
+      for (size_t i = 0; i < m_laneCount; ++i) {
+        iteration[i] &= m_running[i] & (--counters[i] > 0 ? -1 : 0);
+      }
+    }
+  }
+
+  void ExecuteStatementAffineModification(const AstNodeStatementAffineModification* node, Mask& mask) {
+    uint32_t slot = node->GetTargetSlot();
+    if (node->RequiresTarget()) {
+      RequireDefined(slot, mask);
+    }
+
+    std::vector<int64_t> value(m_laneCount, node->GetAddend());
+    if (node->HasSource()) {
+      RequireDefined(node->GetSourceSlot(), mask);
+      const int64_t* source = GetValues(node->GetSourceSlot());
+      for (size_t i = 0; i < m_laneCount; ++i) {
+        value[i] = WrappingAdd(WrappingMultiply(source[i], node->GetMultiplier()), node->GetAddend());
+      }
+    }
+
+    Declare(slot, mask);
+    MaskedModify(ModificationOperatorType::ASSIGN, GetValues(slot), value.data(), mask.data(), m_laneCount);
+  }
+
+  void ExecuteStatement(const AstNode* node, Mask& mask) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        ExecuteStatementChain(node->As<AstNodeStatementChain>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        ExecuteStatementPrint(mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        ExecuteStatementDelete(node->As<AstNodeStatementDelete>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        ExecuteStatementCall(node->As<AstNodeStatementCall>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        ExecuteStatementVariableModification(node->As<AstNodeBinaryStatementVarModification>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        ExecuteStatementFunctionDeclaration(node->As<AstNodeStatementFunctionDeclaration>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        Mask taken = EvaluateCondition(condition->GetCondition().get(), mask);
+        ExecuteStatement(condition->GetCode().get(), taken);
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        ExecuteStatementLoop(node->As<AstNodeStatementLoop>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        // No closed form per lane, the loop itself is already vectorized across lanes
+        ExecuteStatementLoop(node->As<AstNodeStatementAffineLoop>()->GetLoop().get(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_MODIFICATION: {
+        ExecuteStatementAffineModification(node->As<AstNodeStatementAffineModification>(), mask);
+        return;
+      }
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        ExecuteStatementCheckFunction(node->As<AstNodeStatementCheckFunction>()->GetSlot(), mask);
+        return;
+      }
+      default: throw ExecutionException("Unexpected node.");
+    }
+  }
+
+private:
+  SymbolTable m_variableNames;
+  size_t m_laneCount;
+  // slot * laneCount + lane
+  std::vector<int64_t> m_values;
+  // Position in the lane's print order, 0 if undefined
+  std::vector<uint64_t> m_stamps;
+  std::vector<uint64_t> m_nextStamps;
+  // Function slot * laneCount + lane -> body, bound when the declaration executes in that lane
+  std::vector<const AstNodeStatementChain*> m_functions;
+  Mask m_running;
+  std::vector<BatchResult> m_results;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SymbolTable.hpp"
+
+/*
+
+Bytecode
+
+Variables and functions are addressed by slot, loops keep their counters on a separate stack,
+conditions are compiled into compare-and-branch instructions with short-circuiting.
+
+ASSIGN_CONST       slot = immediate (declares the slot if needed)
+ASSIGN_VAR         slot = $operand
+ADD/SUB/MULT_CONST slot op= immediate
+ADD/SUB/MULT_VAR   slot op= $operand
+DELETE             delete slot
+
+JUMP                      goto target
+JUMP_IF_[NOT_]EQUAL_CONST if $slot ==/!= immediate goto target
+JUMP_IF_[NOT_]EQUAL_VAR   if $slot ==/!= $operand goto target
+
+LOOP_BEGIN_CONST   push immediate, if immediate <= 0 pop and goto target
+LOOP_BEGIN_VAR     push $slot, if $slot <= 0 pop and goto target
+LOOP_NEXT          if --top > 0 goto target, otherwise pop
+
+DECLARE_FUNCTION   bind function slot to the body at target
+CALL               call function slot
+CHECK_FUNCTION     fail if function slot is unbound (guards an inlined body)
+RETURN
+
+PRINT              print variables and terminate
+HALT
+
+*/
+
+enum struct OpCode : uint8_t {
+  ASSIGN_CONST,
+  ASSIGN_VAR,
+  ADD_CONST,
+  ADD_VAR,
+  SUB_CONST,
+  SUB_VAR,
+  MULT_CONST,
+  MULT_VAR,
+  DELETE,
+
+  JUMP,
+  JUMP_IF_EQUAL_CONST,
+  JUMP_IF_EQUAL_VAR,
+  JUMP_IF_NOT_EQUAL_CONST,
+  JUMP_IF_NOT_EQUAL_VAR,
+
+  LOOP_BEGIN_CONST,
+  LOOP_BEGIN_VAR,
+  LOOP_NEXT,
+
+  DECLARE_FUNCTION,
+  CALL,
+  CHECK_FUNCTION,
+  RETURN,
+
+  PRINT,
+  HALT,
+
+  COUNT
+};
+
+// Function slot that no declaration has bound yet
+constexpr uint32_t kUnboundFunction = UINT32_MAX;
+
+struct Instruction final {
+  OpCode opCode;
+  uint32_t slot = 0;
+  uint32_t operand = 0;
+  uint32_t target = 0;
+  int64_t immediate = 0;
+};
+
+struct BytecodeProgram final {
+  // Execution starts at 0, function bodies are placed after the main HALT
+  std::vector<Instruction> code;
+  SymbolTable variables;
+  SymbolTable functions;
+};
@@ -0,0 +1,430 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "Bytecode.hpp"
+#include "Exceptions.hpp"
+
+struct CompilerOptions final {
+  // Calls to small functions with a single declaration site are replaced by CHECK_FUNCTION + body
+  bool inlineFunctions = false;
+  uint32_t maxInlineStatements = 8;
+  uint32_t maxInlineDepth = 3;
+};
+
+// AST -> Bytecode. Doesn't execute anything, so the only errors it reports are malformed trees
+struct Compiler final {
+  explicit Compiler(CompilerOptions options = {})
+  : m_options(options) {
+  }
+
+  // Trip count of CompileLoopRemainder, no identifier can have this name
+  static constexpr const char* kLoopCounterName = "#remaining";
+
+  BytecodeProgram Compile(const AstNode* root) {
+    Reset();
+    if (m_options.inlineFunctions) {
+      CollectInlineCandidates(root);
+    }
+
+    CompileStatement(root);
+    Emit(Instruction(OpCode::HALT));
+
+    // Declarations inside of bodies enqueue more bodies, so no range-for here
+    for (size_t i = 0; i < m_pendingFunctions.size(); ++i) {
+      auto [declaration, declarationPosition] = m_pendingFunctions[i];
+      m_program.code[declarationPosition].target = GetPosition();
+      CompileStatement(declaration->GetCode().get());
+      Emit(Instruction(OpCode::RETURN));
+    }
+
+    return std::move(m_program);
+  }
+
+  /*
+
+  Parts of a tree on their own, for NativeTier. Slots are assigned by name as usual, so they
+  have to be mapped to the slots of whoever runs the tree. Declarations inside of a part aren't
+  compiled, there is nothing to run them anyway: the Jit rejects a part that declares anything
+
+  */
+
+  // The body followed by RETURN, a function region for the Jit at 0
+  BytecodeProgram CompileFunctionBody(const AstNode* body) {
+    Reset();
+    CompileStatement(body);
+    Emit(Instruction(OpCode::RETURN));
+    return std::move(m_program);
+  }
+
+  // The iterations of a loop that are left, a loop region for the Jit at 0 running $kLoopCounterName times
+  BytecodeProgram CompileLoopRemainder(const AstNodeStatementLoop* node) {
+    Reset();
+    uint32_t begin = Emit(Instruction(OpCode::LOOP_BEGIN_VAR, m_program.variables.GetOrAdd(kLoopCounterName)));
+    CompileStatement(node->GetCode().get());
+    Emit(Instruction(OpCode::LOOP_NEXT, 0, 0, begin + 1));
+    m_program.code[begin].target = GetPosition();
+    Emit(Instruction(OpCode::HALT));
+    return std::move(m_program);
+  }
+
+private:
+  void Reset() {
+    m_program = BytecodeProgram();
+    m_pendingFunctions.clear();
+    m_inlineCandidates.clear();
+    m_inlineStack.clear();
+  }
+
+  struct Operand final {
+    bool isConstant;
+    uint32_t slot;
+    int64_t value;
+  };
+
+  [[nodiscard]] uint32_t GetPosition() const {
+    return static_cast<uint32_t>(m_program.code.size());
+  }
+
+  uint32_t Emit(const Instruction& instruction) {
+    m_program.code.emplace_back(instruction);
+    return GetPosition() - 1;
+  }
+
+  void PatchJumps(const std::vector<uint32_t>& jumps) {
+    for (uint32_t jump : jumps) {
+      m_program.code[jump].target = GetPosition();
+    }
+  }
+
+  Operand CompileValue(const AstNode* node) {
+    if (node->GetType() == AstNodeType::VALUE_NUMBER) {
+      return Operand(true, 0, node->As<AstNodeValueNumber>()->GetValue());
+    }
+
+    if (node->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      return Operand(false, m_program.variables.GetOrAdd(node->As<AstNodeValueIdentifier>()->GetName()), 0);
+    }
+
+    throw ExecutionException("Unexpected node type.");
+  }
+
+  void CompileComparisonJump(const AstNodeBinaryOperator* node, bool jumpIfEqual, std::vector<uint32_t>& jumps) {
+    Operand left = CompileValue(node->GetLeft().get());
+    Operand right = CompileValue(node->GetRight().get());
+    if (left.isConstant && right.isConstant) {
+      if ((left.value == right.value) == jumpIfEqual) {
+        jumps.emplace_back(Emit(Instruction(OpCode::JUMP)));
+      }
+
+      return;
+    }
+
+    // Comparisons are symmetric, keep the constant on the right
+    if (left.isConstant) {
+      std::swap(left, right);
+    }
+
+    OpCode opCode = right.isConstant
+    ? (jumpIfEqual ? OpCode::JUMP_IF_EQUAL_CONST : OpCode::JUMP_IF_NOT_EQUAL_CONST)
+    : (jumpIfEqual ? OpCode::JUMP_IF_EQUAL_VAR : OpCode::JUMP_IF_NOT_EQUAL_VAR);
+    jumps.emplace_back(Emit(Instruction(opCode, left.slot, right.slot, 0, right.value)));
+  }
+
+  // Both functions fall through when they don't jump. Evaluation order is kept, so short-circuiting
+  // (and the first undefined variable) is the same as in the tree-walker
+  void CompileJumpIfFalse(const AstNode* node, std::vector<uint32_t>& falseJumps) {
+    if (node->GetType() != AstNodeType::BINARY_OPERATOR) {
+      throw ExecutionException("Unexpected node type.");
+    }
+
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    switch (opNode->GetOperatorType()) {
+      case BinaryOperatorType::EQUALS: {
+        CompileComparisonJump(opNode, false, falseJumps);
+        return;
+      }
+      case BinaryOperatorType::NOT_EQUALS: {
+        CompileComparisonJump(opNode, true, falseJumps);
+        return;
+      }
+      case BinaryOperatorType::AND: {
+        CompileJumpIfFalse(opNode->GetLeft().get(), falseJumps);
+        CompileJumpIfFalse(opNode->GetRight().get(), falseJumps);
+        return;
+      }
+      case BinaryOperatorType::OR: {
+        std::vector<uint32_t> trueJumps;
+        CompileJumpIfTrue(opNode->GetLeft().get(), trueJumps);
+        CompileJumpIfFalse(opNode->GetRight().get(), falseJumps);
+        PatchJumps(trueJumps);
+        return;
+      }
+      default: throw ExecutionException("Unexpected node type.");
+    }
+  }
+
+  void CompileJumpIfTrue(const AstNode* node, std::vector<uint32_t>& trueJumps) {
+    if (node->GetType() != AstNodeType::BINARY_OPERATOR) {
+      throw ExecutionException("Unexpected node type.");
+    }
+
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    switch (opNode->GetOperatorType()) {
+      case BinaryOperatorType::EQUALS: {
+        CompileComparisonJump(opNode, true, trueJumps);
+        return;
+      }
+      case BinaryOperatorType::NOT_EQUALS: {
+        CompileComparisonJump(opNode, false, trueJumps);
+        return;
+      }
+      case BinaryOperatorType::AND: {
+        std::vector<uint32_t> falseJumps;
+        CompileJumpIfFalse(opNode->GetLeft().get(), falseJumps);
+        CompileJumpIfTrue(opNode->GetRight().get(), trueJumps);
+        PatchJumps(falseJumps);
+        return;
+      }
+      case BinaryOperatorType::OR: {
+        CompileJumpIfTrue(opNode->GetLeft().get(), trueJumps);
+        CompileJumpIfTrue(opNode->GetRight().get(), trueJumps);
+        return;
+      }
+      default: throw ExecutionException("Unexpected node type.");
+    }
+  }
+
+  void CompileStatementChain(const AstNodeStatementChain* node) {
+    for (const auto& statement : node->GetStatements()) {
+      CompileStatement(statement.get());
+    }
+  }
+
+  void CompileStatementPrint(const AstNodeStatementPrint*) {
+    Emit(Instruction(OpCode::PRINT));
+  }
+
+  void CompileStatementDelete(const AstNodeStatementDelete* node) {
+    Emit(Instruction(OpCode::DELETE, m_program.variables.GetOrAdd(node->GetVariableName())));
+  }
+
+  void CompileStatementCall(const AstNodeStatementCall* node) {
+    uint32_t slot = m_program.functions.GetOrAdd(node->GetFunctionName());
+    auto iter = m_inlineCandidates.find(node->GetFunctionName());
+    bool isInlined = iter != m_inlineCandidates.end() && iter->second
+    && m_inlineStack.size() < m_options.maxInlineDepth
+    && std::find(m_inlineStack.begin(), m_inlineStack.end(), iter->second) == m_inlineStack.end();
+    if (!isInlined) {
+      Emit(Instruction(OpCode::CALL, slot));
+      return;
+    }
+
+    // There is only one declaration, so once the slot is bound it's bound to exactly this body
+    Emit(Instruction(OpCode::CHECK_FUNCTION, slot));
+    m_inlineStack.emplace_back(iter->second);
+    CompileStatement(iter->second->GetCode().get());
+    m_inlineStack.pop_back();
+  }
+
+  void CompileStatementVariableModification(const AstNodeBinaryStatementVarModification* node) {
+    // Indexed by ModificationOperatorType
+    static constexpr OpCode kConstOpCodes[] = { OpCode::ADD_CONST, OpCode::SUB_CONST, OpCode::MULT_CONST, OpCode::ASSIGN_CONST };
+    static constexpr OpCode kVarOpCodes[] = { OpCode::ADD_VAR, OpCode::SUB_VAR, OpCode::MULT_VAR, OpCode::ASSIGN_VAR };
+
+    auto opType = static_cast<uint32_t>(node->GetOperatorType());
+    if (opType >= static_cast<uint32_t>(ModificationOperatorType::COUNT)) {
+      throw ExecutionException("Unexpected node.");
+    }
+
+    uint32_t slot = m_program.variables.GetOrAdd(node->GetVariableName());
+    Operand value = CompileValue(node->GetValue().get());
+    Emit(Instruction(value.isConstant ? kConstOpCodes[opType] : kVarOpCodes[opType], slot, value.slot, 0, value.value));
+  }
+
+  void CompileStatementAffineModification(const AstNodeStatementAffineModification* node) {
+    uint32_t slot = m_program.variables.GetOrAdd(node->GetTargetName());
+    // Reading the target as the source has to fail on it too, even when nothing else is emitted
+    bool isSelfUpdate = node->HasSource() && node->GetSourceName() == node->GetTargetName();
+    if (node->RequiresTarget() || isSelfUpdate) {
+      // Fails on an undefined target, no-op otherwise
+      Emit(Instruction(OpCode::ADD_CONST, slot));
+    }
+
+    if (!node->HasSource()) {
+      Emit(Instruction(OpCode::ASSIGN_CONST, slot, 0, 0, node->GetAddend()));
+      return;
+    }
+
+    uint32_t sourceSlot = m_program.variables.GetOrAdd(node->GetSourceName());
+    if (sourceSlot != slot) {
+      Emit(Instruction(OpCode::ASSIGN_VAR, slot, sourceSlot));
+    }
+
+    if (node->GetMultiplier() != 1) {
+      Emit(Instruction(OpCode::MULT_CONST, slot, 0, 0, node->GetMultiplier()));
+    }
+
+    if (node->GetAddend() != 0) {
+      Emit(Instruction(OpCode::ADD_CONST, slot, 0, 0, node->GetAddend()));
+    }
+  }
+
+  void CompileStatementFunctionDeclaration(const AstNodeStatementFunctionDeclaration* node) {
+    uint32_t position = Emit(Instruction(OpCode::DECLARE_FUNCTION, m_program.functions.GetOrAdd(node->GetFunctionName())));
+    m_pendingFunctions.emplace_back(node, position);
+  }
+
+  void CompileStatementCondition(const AstNodeStatementCondition* node) {
+    std::vector<uint32_t> falseJumps;
+    CompileJumpIfFalse(node->GetCondition().get(), falseJumps);
+    CompileStatement(node->GetCode().get());
+    PatchJumps(falseJumps);
+  }
+
+  void CompileStatementLoop(const AstNodeStatementLoop* node) {
+    Operand count = CompileValue(node->GetInitValue().get());
+    if (count.isConstant && count.value <= 0) {
+      // The body is unreachable
+      return;
+    }
+
+    uint32_t begin = Emit(count.isConstant
+    ? Instruction(OpCode::LOOP_BEGIN_CONST, 0, 0, 0, count.value)
+    : Instruction(OpCode::LOOP_BEGIN_VAR, count.slot));
+    uint32_t bodyStart = GetPosition();
+    CompileStatement(node->GetCode().get());
+    Emit(Instruction(OpCode::LOOP_NEXT, 0, 0, bodyStart));
+    m_program.code[begin].target = GetPosition();
+  }
+
+  // Statements in the subtree, UINT32_MAX if it declares functions (declarations can't be duplicated)
+  static uint32_t CountInlinableStatements(const AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        uint32_t count = 0;
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          uint32_t statementCount = CountInlinableStatements(statement.get());
+          if (statementCount == UINT32_MAX) {
+            return UINT32_MAX;
+          }
+
+          count += statementCount;
+        }
+
+        return count;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        uint32_t count = CountInlinableStatements(node->As<AstNodeStatementCondition>()->GetCode().get());
+        return count == UINT32_MAX ? count : count + 1;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        uint32_t count = CountInlinableStatements(node->As<AstNodeStatementLoop>()->GetCode().get());
+        return count == UINT32_MAX ? count : count + 1;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        return CountInlinableStatements(node->As<AstNodeStatementAffineLoop>()->GetLoop().get());
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        return UINT32_MAX;
+      }
+      default: return 1;
+    }
+  }
+
+  // Name -> declaration if it is declared exactly once and is small enough, nullptr otherwise
+  void CollectInlineCandidates(const AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          CollectInlineCandidates(statement.get());
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        CollectInlineCandidates(node->As<AstNodeStatementCondition>()->GetCode().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        CollectInlineCandidates(node->As<AstNodeStatementLoop>()->GetCode().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        auto [iter, isInserted] = m_inlineCandidates.emplace(declaration->GetFunctionName(), declaration);
+        if (!isInserted || CountInlinableStatements(declaration->GetCode().get()) > m_options.maxInlineStatements) {
+          iter->second = nullptr;
+        }
+
+        CollectInlineCandidates(declaration->GetCode().get());
+        return;
+      }
+      default: return;
+    }
+  }
+
+  void CompileStatement(const AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        CompileStatementChain(node->As<AstNodeStatementChain>());
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        CompileStatementPrint(node->As<AstNodeStatementPrint>());
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        CompileStatementDelete(node->As<AstNodeStatementDelete>());
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        CompileStatementCall(node->As<AstNodeStatementCall>());
+        return;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        CompileStatementVariableModification(node->As<AstNodeBinaryStatementVarModification>());
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        CompileStatementFunctionDeclaration(node->As<AstNodeStatementFunctionDeclaration>());
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        CompileStatementCondition(node->As<AstNodeStatementCondition>());
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        CompileStatementLoop(node->As<AstNodeStatementLoop>());
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_MODIFICATION: {
+        CompileStatementAffineModification(node->As<AstNodeStatementAffineModification>());
+        return;
+      }
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        Emit(Instruction(OpCode::CHECK_FUNCTION, m_program.functions.GetOrAdd(node->As<AstNodeStatementCheckFunction>()->GetFunctionName())));
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        // No closed form in bytecode, the JIT already makes these loops cheap
+        CompileStatementLoop(node->As<AstNodeStatementAffineLoop>()->GetLoop().get());
+        return;
+      }
+      default: throw ExecutionException("Unexpected node.");
+    }
+  }
+
+private:
+  CompilerOptions m_options;
+  BytecodeProgram m_program;
+  std::vector<std::pair<const AstNodeStatementFunctionDeclaration*, uint32_t>> m_pendingFunctions;
+  std::unordered_map<std::string, const AstNodeStatementFunctionDeclaration*> m_inlineCandidates;
+  // Bodies being inlined right now, a body is never inlined into itself
+  std::vector<const AstNodeStatementFunctionDeclaration*> m_inlineStack;
+};
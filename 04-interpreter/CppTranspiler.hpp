@@ -0,0 +1,341 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "SymbolTable.hpp"
+
+/*
+
+AST -> self-contained C++ translation unit
+
+Variables are slots in global arrays (functions share them), every function declaration
+becomes its own C++ function and is bound to its name when the declaration executes, loops become
+for loops. print unwinds the whole program with an exception, so anything after it never runs.
+The produced executable prints exactly what Interpreter would print and reports errors
+the same way Main does.
+
+*/
+
+struct CppTranspiler final {
+  std::string Transpile(const AstNode* root) {
+    m_variables = SymbolTable();
+    m_functions = SymbolTable();
+    m_declarations.clear();
+    m_body.str({});
+    m_body.clear();
+
+    m_body << "void RunProgram() {\n";
+    EmitStatement(root, 1, 0);
+    m_body << "}\n";
+
+    // Bodies may declare more functions while being emitted
+    for (size_t i = 0; i < m_declarations.size(); ++i) {
+      m_body << '\n' << "void " << GetFunctionName(i) << "() {\n";
+      EmitStatement(m_declarations[i]->GetCode().get(), 1, 0);
+      m_body << "}\n";
+    }
+
+    std::ostringstream result;
+    result << kHeader;
+    result << "constexpr uint32_t kVariableCount = " << m_variables.GetSize() << ";\n";
+    result << "constexpr uint32_t kFunctionCount = " << m_functions.GetSize() << ";\n";
+    result << "const char* const kVariableNames[kVariableCount + 1] = {";
+    for (size_t slot = 0; slot < m_variables.GetSize(); ++slot) {
+      result << " \"" << m_variables.GetName(static_cast<uint32_t>(slot)) << "\",";
+    }
+
+    result << " nullptr };\n";
+    result << kRuntime << '\n';
+    for (size_t i = 0; i < m_declarations.size(); ++i) {
+      result << "void " << GetFunctionName(i) << "();\n";
+    }
+
+    result << '\n' << m_body.str() << '\n';
+    result << "} // namespace\n" << kMain;
+    return result.str();
+  }
+
+private:
+  static std::string GetFunctionName(size_t declaration) {
+    return "Function" + std::to_string(declaration);
+  }
+
+  static void Indent(std::ostream& stream, size_t level) {
+    for (size_t i = 0; i < level; ++i) {
+      stream << "  ";
+    }
+  }
+
+  // C++ expression for a value
+  std::string EmitValue(const AstNode* node) {
+    if (node->GetType() == AstNodeType::VALUE_NUMBER) {
+      return "int64_t(" + std::to_string(node->As<AstNodeValueNumber>()->GetValue()) + ")";
+    }
+
+    if (node->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      uint32_t slot = m_variables.GetOrAdd(node->As<AstNodeValueIdentifier>()->GetName());
+      return "Load(" + std::to_string(slot) + ")";
+    }
+
+    throw ExecutionException("Unexpected node type.");
+  }
+
+  // C++ && and || short-circuit left to right, same as EvaluateExpression
+  std::string EmitExpression(const AstNode* node) {
+    if (node->GetType() != AstNodeType::BINARY_OPERATOR) {
+      throw ExecutionException("Unexpected node type.");
+    }
+
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    switch (opNode->GetOperatorType()) {
+      case BinaryOperatorType::EQUALS:
+        return "(" + EmitValue(opNode->GetLeft().get()) + " == " + EmitValue(opNode->GetRight().get()) + ")";
+      case BinaryOperatorType::NOT_EQUALS:
+        return "(" + EmitValue(opNode->GetLeft().get()) + " != " + EmitValue(opNode->GetRight().get()) + ")";
+      case BinaryOperatorType::OR:
+        return "(" + EmitExpression(opNode->GetLeft().get()) + " || " + EmitExpression(opNode->GetRight().get()) + ")";
+      case BinaryOperatorType::AND:
+        return "(" + EmitExpression(opNode->GetLeft().get()) + " && " + EmitExpression(opNode->GetRight().get()) + ")";
+      default: throw ExecutionException("Unexpected node type.");
+    }
+  }
+
+  void EmitStatement(const AstNode* node, size_t indent, size_t loopDepth) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          EmitStatement(statement.get(), indent, loopDepth);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        Indent(m_body, indent);
+        m_body << "Print();\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        Indent(m_body, indent);
+        m_body << "Delete(" << m_variables.GetOrAdd(node->As<AstNodeStatementDelete>()->GetVariableName()) << ");\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        Indent(m_body, indent);
+        m_body << "Call(" << m_functions.GetOrAdd(node->As<AstNodeStatementCall>()->GetFunctionName()) << ");\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        // Indexed by ModificationOperatorType
+        static constexpr const char* kHelpers[] = { "Add", "Subtract", "Multiply", "Assign" };
+
+        const auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+        auto opType = static_cast<uint32_t>(modification->GetOperatorType());
+        if (opType >= static_cast<uint32_t>(ModificationOperatorType::COUNT)) {
+          throw ExecutionException("Unexpected node.");
+        }
+
+        uint32_t slot = m_variables.GetOrAdd(modification->GetVariableName());
+        Indent(m_body, indent);
+        m_body << kHelpers[opType] << '(' << slot << ", " << EmitValue(modification->GetValue().get()) << ");\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        uint32_t slot = m_functions.GetOrAdd(declaration->GetFunctionName());
+        Indent(m_body, indent);
+        m_body << "Declare(" << slot << ", &" << GetFunctionName(m_declarations.size()) << ");\n";
+        m_declarations.emplace_back(declaration);
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        Indent(m_body, indent);
+        m_body << "if " << EmitExpression(condition->GetCondition().get()) << " {\n";
+        EmitStatement(condition->GetCode().get(), indent + 1, loopDepth);
+        Indent(m_body, indent);
+        m_body << "}\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        const auto* loop = node->As<AstNodeStatementLoop>();
+        std::string counter = "counter" + std::to_string(loopDepth);
+        Indent(m_body, indent);
+        m_body << "for (int64_t " << counter << " = " << EmitValue(loop->GetInitValue().get()) << "; "
+        << counter << " > 0; --" << counter << ") {\n";
+        EmitStatement(loop->GetCode().get(), indent + 1, loopDepth + 1);
+        Indent(m_body, indent);
+        m_body << "}\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_MODIFICATION: {
+        const auto* modification = node->As<AstNodeStatementAffineModification>();
+        uint32_t slot = m_variables.GetOrAdd(modification->GetTargetName());
+        Indent(m_body, indent);
+        if (modification->RequiresTarget()) {
+          m_body << "Reference(" << slot << ");\n";
+          Indent(m_body, indent);
+        }
+
+        // Fused coefficients can be any int64, INT64_MIN included, so they are spelled as unsigned literals
+        std::string addend = std::to_string(static_cast<uint64_t>(modification->GetAddend())) + "ull";
+        if (!modification->HasSource()) {
+          m_body << "Assign(" << slot << ", int64_t(" << addend << "));\n";
+          return;
+        }
+
+        uint32_t sourceSlot = m_variables.GetOrAdd(modification->GetSourceName());
+        std::string multiplier = std::to_string(static_cast<uint64_t>(modification->GetMultiplier())) + "ull";
+        m_body << "Assign(" << slot << ", int64_t(uint64_t(Load(" << sourceSlot << ")) * " << multiplier << " + " << addend << "));\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        Indent(m_body, indent);
+        m_body << "Check(" << m_functions.GetOrAdd(node->As<AstNodeStatementCheckFunction>()->GetFunctionName()) << ");\n";
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        EmitStatement(node->As<AstNodeStatementAffineLoop>()->GetLoop().get(), indent, loopDepth);
+        return;
+      }
+      default: throw ExecutionException("Unexpected node.");
+    }
+  }
+
+private:
+  static constexpr const char* kHeader = R"(// Generated from a 04-interpreter program
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+)";
+
+  static constexpr const char* kRuntime = R"(constexpr uint32_t kNone = UINT32_MAX;
+
+// Slots, print order is threaded through prev/next
+int64_t g_values[kVariableCount + 1];
+bool g_isDefined[kVariableCount + 1];
+uint32_t g_prev[kVariableCount + 1];
+uint32_t g_next[kVariableCount + 1];
+uint32_t g_head = kNone;
+uint32_t g_tail = kNone;
+
+using Function = void (*)();
+Function g_functions[kFunctionCount + 1];
+
+// Thrown by print, nothing runs after it
+struct Terminate final {
+};
+
+[[noreturn]] void Fail(const char* message) {
+  throw std::runtime_error(message);
+}
+
+inline int64_t Load(uint32_t slot) {
+  if (!g_isDefined[slot]) {
+    Fail("Undefined variable.");
+  }
+
+  return g_values[slot];
+}
+
+inline int64_t& Reference(uint32_t slot) {
+  if (!g_isDefined[slot]) {
+    Fail("Undefined variable.");
+  }
+
+  return g_values[slot];
+}
+
+inline void Assign(uint32_t slot, int64_t value) {
+  if (!g_isDefined[slot]) {
+    g_prev[slot] = g_tail;
+    g_next[slot] = kNone;
+    (g_tail == kNone ? g_head : g_next[g_tail]) = slot;
+    g_tail = slot;
+    g_isDefined[slot] = true;
+  }
+
+  g_values[slot] = value;
+}
+
+inline void Add(uint32_t slot, int64_t value) {
+  int64_t& target = Reference(slot);
+  target = static_cast<int64_t>(static_cast<uint64_t>(target) + static_cast<uint64_t>(value));
+}
+
+inline void Subtract(uint32_t slot, int64_t value) {
+  int64_t& target = Reference(slot);
+  target = static_cast<int64_t>(static_cast<uint64_t>(target) - static_cast<uint64_t>(value));
+}
+
+inline void Multiply(uint32_t slot, int64_t value) {
+  int64_t& target = Reference(slot);
+  target = static_cast<int64_t>(static_cast<uint64_t>(target) * static_cast<uint64_t>(value));
+}
+
+inline void Delete(uint32_t slot) {
+  if (!g_isDefined[slot]) {
+    Fail("Undefined variable.");
+  }
+
+  (g_prev[slot] == kNone ? g_head : g_next[g_prev[slot]]) = g_next[slot];
+  (g_next[slot] == kNone ? g_tail : g_prev[g_next[slot]]) = g_prev[slot];
+  g_isDefined[slot] = false;
+}
+
+[[noreturn]] void Print() {
+  for (uint32_t slot = g_head; slot != kNone; slot = g_next[slot]) {
+    std::cout << kVariableNames[slot] << " = " << g_values[slot] << '\n';
+  }
+
+  throw Terminate();
+}
+
+inline void Declare(uint32_t slot, Function function) {
+  if (g_functions[slot]) {
+    Fail("Function is already defined.");
+  }
+
+  g_functions[slot] = function;
+}
+
+inline void Check(uint32_t slot) {
+  if (!g_functions[slot]) {
+    Fail("Undefined function.");
+  }
+}
+
+inline void Call(uint32_t slot) {
+  Check(slot);
+  g_functions[slot]();
+}
+)";
+
+  static constexpr const char* kMain = R"(
+int main() {
+  try {
+    RunProgram();
+  } catch (const Terminate&) {
+  } catch (const std::runtime_error& e) {
+    std::cout << e.what() << '\n';
+    std::cout << "Fail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n";
+    return 3;
+  }
+
+  return 0;
+}
+)";
+
+private:
+  SymbolTable m_variables;
+  SymbolTable m_functions;
+  std::vector<const AstNodeStatementFunctionDeclaration*> m_declarations;
+  std::ostringstream m_body;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdexcept>
+
+// Shared by every backend, so that a script fails with the same message
+// no matter what executes it
+struct ExecutionException final : std::runtime_error {
+  explicit ExecutionException(const char* message)
+  : std::runtime_error(message) {
+  }
+};
+
+// A run went over one of its ExecutionLimits. That's the host's cap and not an error in the script,
+// so it's kept apart from ExecutionException
+struct LimitExceededException final : std::runtime_error {
+  explicit LimitExceededException(const char* message)
+  : std::runtime_error(message) {
+  }
+};
+
+// The source doesn't lex or parse, thrown by Compile before anything runs
+struct CompileException final : std::runtime_error {
+  explicit CompileException(const char* message)
+  : std::runtime_error(message) {
+  }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "AstNodes.hpp"
+#include "Optimizer.hpp"
+#include "Resolver.hpp"
+
+// Finishes function bodies the Optimizer deferred (OptimizerOptions::deferFunctionBodies) on their first
+// call: optimizes them with the Optimizer that ran on the program and resolves them with its Resolver.
+// A run pays only for the functions it calls, the rest is parsed and resolved but never optimized.
+// Results are cached on the declarations, so every Interpreter running the tree shares them, forks and
+// other threads included
+struct FunctionCompiler final {
+  FunctionCompiler(Optimizer optimizer, Resolver resolver)
+  : m_optimizer(std::move(optimizer))
+  , m_resolver(std::move(resolver)) {
+  }
+
+  FunctionCompiler(const FunctionCompiler&) = delete;
+  FunctionCompiler& operator=(const FunctionCompiler&) = delete;
+
+  // Bodies are chains, so are the optimized ones
+  const AstNodeStatementChain* GetBody(const AstNodeStatementFunctionDeclaration* declaration) {
+    const AstNode* code = declaration->GetCompiledCode([this](const std::shared_ptr<AstNode>& original) {
+      // Bodies of different functions may be compiled at once, both passes keep state of their own
+      std::lock_guard lock(m_mutex);
+      std::shared_ptr<AstNode> optimized = m_optimizer.OptimizeFunctionBody(original);
+      m_resolver.Resolve(optimized.get());
+      ++m_compiledCount;
+      return optimized;
+    });
+    return code->As<AstNodeStatementChain>();
+  }
+
+  // Bodies compiled so far
+  [[nodiscard]] size_t GetCompiledCount() const {
+    std::lock_guard lock(m_mutex);
+    return m_compiledCount;
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  Optimizer m_optimizer;
+  // Slots are already assigned for every name a body can mention, so resolving doesn't change the tables
+  Resolver m_resolver;
+  size_t m_compiledCount = 0;
+};
@@ -1,10 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <bitset>
-#include <iostream>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include "AffineTransform.hpp"
+#include "Arithmetic.hpp"
 #include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "FunctionCompiler.hpp"
+#include "InterpreterHooks.hpp"
+#include "Jit.hpp"
+#include "NativeTier.hpp"
+#include "OutputSink.hpp"
+#include "PersistentVariableStorage.hpp"
+#include "Snapshot.hpp"
+#include "SymbolTable.hpp"
 
 /*
 
@@ -22,43 +36,464 @@ EvaluateStatement() -> Interpreter modification
 
 */
 
-struct ExecutionException final : std::exception {
-  explicit ExecutionException(const char* message)
-  : std::exception(message) {
-  }
+// Caps for untrusted scripts, exceeding one throws LimitExceededException. Statements are counted
+// per block entered and everything is checked at loop back-edges and calls only, so a run
+// may overshoot a limit by one stretch of code without loops or calls
+struct ExecutionLimits final {
+  uint64_t maxStatements = UINT64_MAX;
+  // Calls in progress, the same in either mode: a tail call counts even when the explicit stack runs it in place
+  uint32_t maxCallDepth = UINT32_MAX;
+  size_t maxLiveVariables = SIZE_MAX;
 };
 
-struct Variable final {
-  std::string name;
-  int64_t value;
+struct InterpreterOptions final {
+  // Blocks and calls are run from a heap allocated stack of frames instead of recursing on the C++ stack,
+  // so deep recursion is bounded by maxStackBytes rather than the thread stack
+  bool useExplicitStack = false;
+  // Exceeding it fails with "Stack overflow."
+  size_t maxStackBytes = size_t(64) << 20;
+  ExecutionLimits limits;
 };
 
-struct Interpreter final {
+// Variables and functions are addressed by the slots Resolver assigned, root has to be resolved against the same tables.
+// Hooks are called at compile time, see InterpreterHooks.hpp
+template <typename Hooks = NoHooks>
+struct BasicInterpreter final {
+  static constexpr bool kHasHooks = !std::is_same_v<Hooks, NoHooks>;
+
+  explicit BasicInterpreter(const SymbolTable& variables, const SymbolTable& functions, InterpreterOptions options = {}, Hooks hooks = {})
+  : BasicInterpreter(std::make_shared<const SymbolTable>(variables), std::make_shared<const SymbolTable>(functions), options, std::move(hooks)) {
+  }
+
+  // Tables shared with whoever else runs the same program, nothing is copied
+  explicit BasicInterpreter(std::shared_ptr<const SymbolTable> variables, std::shared_ptr<const SymbolTable> functions, InterpreterOptions options = {}, Hooks hooks = {})
+  : m_options(options)
+  , m_hooks(std::move(hooks))
+  , m_variableNames(std::move(variables))
+  , m_functionNames(std::move(functions))
+  , m_bindings(std::make_shared<Bindings>(m_functionNames->GetSize()))
+  , m_output(&OutputSink::Standard()) {
+    m_variables.Resize(m_variableNames->GetSize());
+  }
+
+  BasicInterpreter(BasicInterpreter&&) noexcept = default;
+  BasicInterpreter& operator=(BasicInterpreter&&) noexcept = default;
+
+  // The whole state, a run in progress included when forked between Resume calls. Variables and
+  // functions are shared until either side changes them, so forking costs the same for any number
+  // of variables and a fork pays only for the slots it writes. The program, the output sink and the
+  // tables are shared for good, and so is whatever the hooks point at (statements the parent has entered
+  // stay the parent's). Forks may run on other threads once made, as long as their hooks allow it
+  [[nodiscard]] BasicInterpreter Fork() {
+    return BasicInterpreter(*this, m_variables.Fork());
+  }
+
+  [[nodiscard]] Hooks& GetHooks() {
+    return m_hooks;
+  }
+
+  // Assigns a variable from outside the program, declaring it at the end of the print order if needed
+  void Define(uint32_t slot, int64_t value) {
+    m_variables.Set(slot, value);
+  }
+
+  [[nodiscard]] std::optional<int64_t> GetVariable(uint32_t slot) const {
+    if (slot >= m_variables.GetSlotCount() || !m_variables.IsDefined(slot)) {
+      return std::nullopt;
+    }
+
+    return m_variables.Get(slot);
+  }
+
+  // Visits (slot, value) in print order
+  template <typename Func>
+  void ForEachVariable(Func func) const {
+    m_variables.ForEach(func);
+  }
+
   void Reset() {
     m_shouldTerminate = false;
   }
 
+  // Print writes there, the sink has to outlive the Interpreter
+  void SetOutput(OutputSink& output) {
+    m_output = &output;
+  }
+
+  // Bodies are then taken from it on every call instead of from the declarations as they are.
+  // Shared by forks, it has to outlive all of them
+  void SetFunctionCompiler(FunctionCompiler* compiler) {
+    m_functionCompiler = compiler;
+  }
+
+  // Hot loops and function bodies are then compiled to native code, loops switch to it at a back-edge
+  // and functions on a call. Returns false if the platform has no JIT, there are hooks (profiling and
+  // tracing included), statements are limited (native code doesn't count them) or the stack is explicit
+  // (a resumable run has to be able to stop after any step)
+  bool EnableNativeTier(JitOptions options = {}) {
+    if (!Jit::kIsSupported || kHasHooks || m_options.limits.maxStatements != UINT64_MAX || m_options.useExplicitStack) {
+      return false;
+    }
+
+    m_nativeTier = std::make_unique<NativeTier>(m_variableNames, m_functionNames, options);
+    return true;
+  }
+
   void Evaluate(const AstNode* root) noexcept(false) {
     if (m_shouldTerminate) {
       return;
     }
 
+    if (m_options.useExplicitStack) {
+      Start(root);
+      Resume(UINT64_MAX);
+      return;
+    }
+
+    m_statementCount = 0;
+    m_callDepth = 0;
     EvaluateStatement(root);
   }
 
+  // Resumable execution on the explicit stack (regardless of useExplicitStack): Start, then Resume
+  // with a step budget until it returns true. Cancel drops whatever is left
+  void Start(const AstNode* root) {
+    m_frames.clear();
+    m_stepCount = 0;
+    m_statementCount = 0;
+    m_callDepth = 0;
+    if (!m_shouldTerminate) {
+      PushFrame(root, 1);
+    }
+  }
+
+  // Runs at most stepBudget steps (a statement or a loop iteration each). Returns true once the
+  // program has finished. Errors are thrown as usual and finish it too
+  bool Resume(uint64_t stepBudget) noexcept(false) {
+    try {
+      RunFrames(stepBudget);
+    } catch (...) {
+      m_frames.clear();
+      throw;
+    }
+
+    return IsFinished();
+  }
+
+  void Cancel() {
+    m_frames.clear();
+    m_callDepth = 0;
+  }
+
+  [[nodiscard]] bool IsFinished() const {
+    return m_frames.empty() || m_shouldTerminate;
+  }
+
+  // Steps run since Start
+  [[nodiscard]] uint64_t GetStepCount() const {
+    return m_stepCount;
+  }
+
+  [[nodiscard]] size_t GetStackDepth() const {
+    return m_frames.size();
+  }
+
+  // Statements charged against ExecutionLimits::maxStatements
+  [[nodiscard]] uint64_t GetStatementCount() const {
+    return m_statementCount;
+  }
+
+  // Variables in print order, bound functions and whether print has run. Only between runs
+  void Save(SnapshotWriter& snapshot) const {
+    m_variables.ForEach([this, &snapshot](uint32_t slot, int64_t value) {
+      snapshot.AddVariable(m_variableNames->GetName(slot), value);
+    });
+
+    const auto& declarations = m_bindings->declarations;
+    for (uint32_t slot = 0; slot < declarations.size(); ++slot) {
+      if (declarations[slot]) {
+        snapshot.AddFunction(m_functionNames->GetName(slot), declarations[slot]->GetSourcePosition());
+      }
+    }
+
+    snapshot.SetTerminated(m_shouldTerminate);
+  }
+
+  // Replaces the state with the snapshot. program is the snapshot source parsed again and resolved against
+  // the same tables as this Interpreter, functions are bound to its declarations. Returns false if they don't match
+  bool Restore(const SnapshotFile& snapshot, const AstNode* program) {
+    std::vector<const AstNodeStatementFunctionDeclaration*> declarations;
+    CollectDeclarations(program, declarations);
+
+    auto bindings = std::make_shared<Bindings>(m_bindings->bodies.size());
+    for (size_t i = 0; i < snapshot.GetFunctionCount(); ++i) {
+      const SnapshotFunction& function = snapshot.GetFunctions()[i];
+      std::string_view name = snapshot.GetName(function.nameOffset, function.nameSize);
+      auto iter = std::find_if(declarations.begin(), declarations.end(), [&](const AstNodeStatementFunctionDeclaration* declaration) {
+        SourcePosition position = declaration->GetSourcePosition();
+        return declaration->GetFunctionName() == name
+          && position.line == function.declaration.line && position.column == function.declaration.column;
+      });
+      uint32_t slot = iter == declarations.end() ? SymbolTable::kInvalidSlot : (*iter)->GetSlot();
+      if (slot >= bindings->bodies.size()) {
+        return false;
+      }
+
+      const AstNodeStatementFunctionDeclaration* declaration = *iter;
+      bindings->bodies[slot] = declaration->GetCode()->As<AstNodeStatementChain>();
+      bindings->declarations[slot] = declaration;
+    }
+
+    PersistentVariableStorage variables;
+    variables.Resize(m_variables.GetSlotCount());
+    for (size_t i = 0; i < snapshot.GetVariableCount(); ++i) {
+      const SnapshotVariable& variable = snapshot.GetVariables()[i];
+      uint32_t slot = m_variableNames->Find(std::string(snapshot.GetName(variable.nameOffset, variable.nameSize)));
+      if (slot >= variables.GetSlotCount()) {
+        return false;
+      }
+
+      variables.Set(slot, variable.value);
+    }
+
+    m_variables = std::move(variables);
+    m_bindings = std::move(bindings);
+    m_isBindingsShared = false;
+
+    m_shouldTerminate = snapshot.IsTerminated();
+    m_frames.clear();
+    return true;
+  }
+
 private:
+  // Function slot -> body, bound when the declaration executes, and the declaration it comes from for snapshots
+  struct Bindings final {
+    explicit Bindings(size_t functionCount)
+    : bodies(functionCount, nullptr)
+    , declarations(functionCount, nullptr) {
+    }
+
+    std::vector<const AstNodeStatementChain*> bodies;
+    std::vector<const AstNodeStatementFunctionDeclaration*> declarations;
+  };
+
+  BasicInterpreter(BasicInterpreter& parent, PersistentVariableStorage variables)
+  : m_options(parent.m_options)
+  , m_hooks(parent.m_hooks)
+  , m_shouldTerminate(parent.m_shouldTerminate)
+  , m_variableNames(parent.m_variableNames)
+  , m_functionNames(parent.m_functionNames)
+  , m_variables(std::move(variables))
+  , m_bindings(parent.m_bindings)
+  , m_isBindingsShared(true)
+  , m_frames(parent.m_frames)
+  , m_output(parent.m_output)
+  , m_functionCompiler(parent.m_functionCompiler)
+  , m_nativeTier(parent.m_nativeTier ? std::make_unique<NativeTier>(m_variableNames, m_functionNames, parent.m_nativeTier->GetOptions()) : nullptr)
+  , m_stepCount(parent.m_stepCount)
+  , m_statementCount(parent.m_statementCount)
+  , m_callDepth(parent.m_callDepth) {
+    parent.m_isBindingsShared = true;
+    for (Frame& frame : m_frames) {
+      frame.entered = nullptr;
+    }
+  }
+
+  /*
+
+  Explicit stack
+
+  Every frame is a block that is being run: a chain, a condition or loop body, or a function body.
+  A frame with nothing left to run is popped before anything is pushed on top of it, so a call
+  (or any block) in tail position replaces the frame it ends instead of growing the stack.
+  A function that recurses as its last statement runs in constant space. The calls it ends are still
+  in progress though, the frame carries them on, so call depth counts them just like recursion does.
+
+  Everything that can't run a block (modifications, print, declarations, affine statements)
+  goes through EvaluateStatement as usual.
+
+  The whole state of the run lives in m_frames, so it can stop after any step and pick up
+  later, which is what Start/Resume do.
+
+  */
+
+  struct Frame final {
+    // Null if the block is a single statement
+    const AstNodeStatementChain* chain;
+    const AstNode* code;
+    size_t next;
+    size_t size;
+    // Iterations left including the current one, 1 for anything but loops
+    int64_t remaining;
+    // Calls that return when the frame ends
+    uint32_t callCount;
+    // The statement that pushed it, entered in the hooks until the frame ends. Always null without hooks
+    const AstNode* entered;
+  };
+
+  // statement is the condition, loop or call that runs the block, if any
+  void PushFrame(const AstNode* code, int64_t remaining, const AstNode* statement = nullptr) {
+    uint32_t tailCalls = 0;
+    while (!m_frames.empty() && m_frames.back().next == m_frames.back().size && m_frames.back().remaining <= 1) {
+      tailCalls += m_frames.back().callCount;
+      if (kHasHooks && m_frames.back().entered) {
+        m_hooks.OnExit(m_frames.back().entered);
+      }
+
+      m_frames.pop_back();
+    }
+
+    if ((m_frames.size() + 1) * sizeof(Frame) > m_options.maxStackBytes) {
+      throw ExecutionException("Stack overflow.");
+    }
+
+    // A block in tail position is still inside the calls it ends, a call there adds one more
+    bool isCall = statement && statement->GetType() == AstNodeType::STATEMENT_CALL;
+    uint32_t callCount = tailCalls + (isCall ? 1 : 0);
+    m_callDepth = m_callDepth - tailCalls + callCount;
+    if (isCall) {
+      CheckCall();
+    }
+
+    const auto* chain = code->As<AstNodeStatementChain>();
+    size_t size = chain ? chain->GetStatements().size() : 1;
+    m_statementCount += size;
+    const AstNode* entered = kHasHooks ? statement : nullptr;
+    if (entered) {
+      m_hooks.OnEnter(entered);
+      if (entered->GetType() == AstNodeType::STATEMENT_LOOP) {
+        m_hooks.OnIterations(entered, 1);
+      }
+    }
+
+    m_frames.emplace_back(chain, code, 0, size, remaining, callCount, entered);
+  }
+
+  void PopFrame() {
+    m_callDepth -= m_frames.back().callCount;
+    if (kHasHooks && m_frames.back().entered) {
+      m_hooks.OnExit(m_frames.back().entered);
+    }
+
+    m_frames.pop_back();
+  }
+
+  // For a block statement that turned out to have nothing to run
+  void EnterSkipped(const AstNode* statement) {
+    m_hooks.OnEnter(statement);
+    m_hooks.OnExit(statement);
+  }
+
+  void RunFrames(uint64_t stepBudget) {
+    for (; stepBudget > 0 && !m_frames.empty() && !m_shouldTerminate; --stepBudget) {
+      ++m_stepCount;
+      Frame& frame = m_frames.back();
+      if (frame.next == frame.size) {
+        if (--frame.remaining > 0) {
+          frame.next = 0;
+          m_statementCount += frame.size;
+          if (kHasHooks && frame.entered) {
+            m_hooks.OnIterations(frame.entered, 1);
+          }
+
+          CheckLimits();
+        } else {
+          PopFrame();
+        }
+
+        continue;
+      }
+
+      const AstNode* statement = frame.chain ? frame.chain->GetStatements()[frame.next].get() : frame.code;
+      ++frame.next;
+      switch (statement->GetType()) {
+        case AstNodeType::STATEMENT_CHAIN: {
+          PushFrame(statement, 1);
+          break;
+        }
+        case AstNodeType::STATEMENT_CONDITION: {
+          m_hooks.OnStatement(statement);
+          const auto* condition = statement->As<AstNodeStatementCondition>();
+          if (EvaluateExpression(condition->GetCondition().get())) {
+            PushFrame(condition->GetCode().get(), 1, statement);
+          } else {
+            EnterSkipped(statement);
+          }
+
+          break;
+        }
+        case AstNodeType::STATEMENT_LOOP: {
+          m_hooks.OnStatement(statement);
+          const auto* loop = statement->As<AstNodeStatementLoop>();
+          int64_t count = EvaluateValue(loop->GetInitValue().get());
+          if (count > 0) {
+            PushFrame(loop->GetCode().get(), count, statement);
+          } else {
+            EnterSkipped(statement);
+          }
+
+          break;
+        }
+        case AstNodeType::STATEMENT_CALL: {
+          const auto* call = statement->As<AstNodeStatementCall>();
+          uint32_t slot = call->GetSlot();
+          m_hooks.OnStatement(statement);
+          m_hooks.OnCall(call);
+          const AstNodeStatementChain* body = GetBody(slot);
+          PushFrame(body, 1, statement);
+          break;
+        }
+        default: {
+          EvaluateStatement(statement);
+          break;
+        }
+      }
+    }
+  }
+
+  static void CollectDeclarations(const AstNode* node, std::vector<const AstNodeStatementFunctionDeclaration*>& declarations) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          CollectDeclarations(statement.get(), declarations);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        declarations.emplace_back(declaration);
+        CollectDeclarations(declaration->GetCode().get(), declarations);
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        CollectDeclarations(node->As<AstNodeStatementCondition>()->GetCode().get(), declarations);
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        CollectDeclarations(node->As<AstNodeStatementLoop>()->GetCode().get(), declarations);
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        CollectDeclarations(node->As<AstNodeStatementAffineLoop>()->GetLoop().get(), declarations);
+        return;
+      }
+      default: return;
+    }
+  }
+
   int64_t EvaluateValue(const AstNode* node) {
     if (node->GetType() == AstNodeType::VALUE_NUMBER) {
       return node->As<AstNodeValueNumber>()->GetValue();
     }
 
     if (node->GetType() == AstNodeType::VALUE_IDENTIFIER) {
-      const auto& varName = node->As<AstNodeValueIdentifier>()->GetName();
-      if (!m_variables.contains(varName)) {
+      uint32_t slot = node->As<AstNodeValueIdentifier>()->GetSlot();
+      if (!m_variables.IsDefined(slot)) {
         throw ExecutionException("Undefined variable.");
       }
 
-      return m_variables.at(varName)->value;
+      return m_variables.Get(slot);
     }
 
     throw ExecutionException("Unexpected node type.");
@@ -89,12 +524,31 @@ private:
     throw ExecutionException("Unexpected node type.");
   }
 
+  void CheckLimits() const {
+    if (m_statementCount > m_options.limits.maxStatements) {
+      throw LimitExceededException("Statement limit exceeded.");
+    }
+
+    if (m_variables.GetDefinedCount() > m_options.limits.maxLiveVariables) {
+      throw LimitExceededException("Variable limit exceeded.");
+    }
+  }
+
+  void CheckCall() const {
+    if (m_callDepth > m_options.limits.maxCallDepth) {
+      throw LimitExceededException("Call depth limit exceeded.");
+    }
+
+    CheckLimits();
+  }
+
   void EvaluateStatementChain(const AstNodeStatementChain* node) {
     if (m_shouldTerminate) {
       return;
     }
 
     const auto& statements = node->GetStatements();
+    m_statementCount += statements.size();
     for (auto iter = statements.begin(), end = statements.end(); !m_shouldTerminate && iter != end; ++iter) {
       EvaluateStatement(iter->get());
     }
@@ -106,9 +560,10 @@ private:
     }
 
     m_shouldTerminate = true;
-    for (const auto& variable : m_values) {
-      std::cout << variable.name << " = " << variable.value << '\n';
-    }
+    m_variables.ForEach([this](uint32_t slot, int64_t value) {
+      m_output->WriteVariable(m_variableNames->GetName(slot), value);
+    });
+    m_output->Flush();
   }
 
   void EvaluateStatementDelete(const AstNodeStatementDelete* node) {
@@ -116,13 +571,14 @@ private:
       return;
     }
 
-    const auto& name = node->GetVariableName();
-    if (!m_variables.contains(name)) {
+    uint32_t slot = node->GetSlot();
+    if (!m_variables.IsDefined(slot)) {
       throw ExecutionException("Undefined variable.");
     }
 
-    m_values.erase(m_variables.at(name));
-    m_variables.erase(name);
+    m_hooks.OnDelete(node, slot, m_variables.Get(slot));
+
+    m_variables.Erase(slot);
   }
 
   void EvaluateStatementCall(const AstNodeStatementCall* node) {
@@ -130,12 +586,36 @@ private:
       return;
     }
 
-    const auto& name = node->GetFunctionName();
-    if (!m_functions.contains(name)) {
+    m_hooks.OnCall(node);
+
+    // A name can be declared only once, so a bound slot never changes and doubles as the call site cache
+    const AstNodeStatementChain* body = GetBody(node->GetSlot());
+    ++m_callDepth;
+    CheckCall();
+    if (!m_nativeTier || !m_nativeTier->TryRunFunction(body, m_variables, m_bindings->bodies)) {
+      EvaluateStatementChain(body);
+    }
+
+    --m_callDepth;
+  }
+
+  const AstNodeStatementChain* GetBody(uint32_t slot) {
+    const AstNodeStatementChain* body = m_bindings->bodies[slot];
+    if (!body) {
       throw ExecutionException("Undefined function.");
     }
 
-    EvaluateStatement(m_functions.at(name).get());
+    return m_functionCompiler ? m_functionCompiler->GetBody(m_bindings->declarations[slot]) : body;
+  }
+
+  void EvaluateStatementCheckFunction(const AstNodeStatementCheckFunction* node) {
+    if (m_shouldTerminate) {
+      return;
+    }
+
+    if (!m_bindings->bodies[node->GetSlot()]) {
+      throw ExecutionException("Undefined function.");
+    }
   }
 
   void EvaluateStatementVariableModification(const AstNodeBinaryStatementVarModification* node) {
@@ -143,38 +623,48 @@ private:
       return;
     }
 
-    const auto& varName = node->GetVariableName();
+    uint32_t slot = node->GetSlot();
     if (node->GetOperatorType() == ModificationOperatorType::ASSIGN) {
-      // Reassignment
-      if (m_variables.contains(varName)) {
-        m_variables.at(varName)->value = EvaluateValue(node->GetValue().get());
-        return;
-      }
-
-      // Declaration
-      m_variables.emplace(varName, m_values.emplace(m_values.end(), varName, EvaluateValue(node->GetValue().get())));
+      // Reassignment or declaration
+      int64_t value = EvaluateValue(node->GetValue().get());
+      BeforeWrite(node, slot, value);
+      m_variables.Set(slot, value);
       return;
     }
 
-    if (!m_variables.contains(varName)) {
+    if (!m_variables.IsDefined(slot)) {
       throw ExecutionException("Undefined variable.");
     }
 
+    auto& value = m_variables.At(slot);
+    int64_t result = 0;
     switch (node->GetOperatorType()) {
       case ModificationOperatorType::ADD: {
-        m_variables.at(varName)->value += EvaluateValue(node->GetValue().get());
-        return;
+        result = WrappingAdd(value, EvaluateValue(node->GetValue().get()));
+        break;
       }
       case ModificationOperatorType::SUBTRACT: {
-        m_variables.at(varName)->value -= EvaluateValue(node->GetValue().get());
-        return;
+        result = WrappingSubtract(value, EvaluateValue(node->GetValue().get()));
+        break;
       }
       case ModificationOperatorType::MULTIPLY: {
-        m_variables.at(varName)->value *= EvaluateValue(node->GetValue().get());
-        return;
+        result = WrappingMultiply(value, EvaluateValue(node->GetValue().get()));
+        break;
       }
       default: throw ExecutionException("Unexpected node.");
     }
+
+    m_hooks.OnWrite(node, slot, true, value, result);
+
+    value = result;
+  }
+
+  // Before an assignment, while the old value is still there
+  void BeforeWrite(const AstNode* node, uint32_t slot, int64_t value) {
+    if constexpr (kHasHooks) {
+      bool isDefined = m_variables.IsDefined(slot);
+      m_hooks.OnWrite(node, slot, isDefined, isDefined ? m_variables.Get(slot) : 0, value);
+    }
   }
 
   void EvaluateStatementFunctionDeclaration(const AstNodeStatementFunctionDeclaration* node) {
@@ -182,12 +672,23 @@ private:
       return;
     }
 
-    const auto& name = node->GetFunctionName();
-    if (m_functions.contains(name)) {
+    if (m_bindings->bodies[node->GetSlot()]) {
       throw ExecutionException("Function is already defined.");
     }
 
-    m_functions.emplace(name, node->GetCode());
+    const auto* body = node->GetCode()->As<AstNodeStatementChain>();
+    if (!body) {
+      throw ExecutionException("Unexpected node.");
+    }
+
+    // Declarations are rare, copying every binding on the first one after a fork is cheap enough
+    if (m_isBindingsShared) {
+      m_bindings = std::make_shared<Bindings>(*m_bindings);
+      m_isBindingsShared = false;
+    }
+
+    m_bindings->bodies[node->GetSlot()] = body;
+    m_bindings->declarations[node->GetSlot()] = node;
   }
 
   void EvaluateStatementCondition(const AstNodeStatementCondition* node) {
@@ -207,9 +708,153 @@ private:
 
     // Evaluate a wolf
     int64_t iterator = EvaluateValue(node->GetInitValue().get());
-    while (iterator > 0) {
+    NativeTier::Site* site = m_nativeTier && iterator > 1 ? &m_nativeTier->GetSite(node) : nullptr;
+    // After a print nothing runs or counts against the limits, so the rest of the passes must not either
+    while (iterator > 0 && !m_shouldTerminate) {
+      m_hooks.OnIterations(node, 1);
+
       EvaluateStatement(node->GetCode().get());
       --iterator;
+      CheckLimits();
+      if (site && iterator > 0 && !m_shouldTerminate && m_nativeTier->TryRunLoop(*site, node, iterator, m_variables, m_bindings->bodies)) {
+        return;
+      }
+    }
+  }
+
+  void EvaluateStatementAffineLoop(const AstNodeStatementAffineLoop* node) {
+    if (m_shouldTerminate) {
+      return;
+    }
+
+    const AstNodeStatementLoop* loop = node->GetLoop().get();
+    int64_t iterator = EvaluateValue(loop->GetInitValue().get());
+    if (iterator <= 0) {
+      return;
+    }
+
+    m_hooks.OnIterations(node, static_cast<uint64_t>(iterator));
+
+    // The first iteration declares whatever the body assigns and fails on whatever is undefined.
+    // After it the body can't fail or change the print order, so the rest is just arithmetic
+    EvaluateStatement(loop->GetCode().get());
+    auto remaining = static_cast<uint64_t>(iterator - 1);
+    const auto& slots = node->GetSlots();
+    if (remaining <= slots.size() * slots.size()) {
+      for (; remaining > 0; --remaining) {
+        EvaluateStatement(loop->GetCode().get());
+        CheckLimits();
+      }
+
+      return;
+    }
+
+    // Charged as if the iterations ran, so limits don't depend on the optimizer
+    const auto* chain = loop->GetCode()->As<AstNodeStatementChain>();
+    uint64_t bodySize = chain ? chain->GetStatements().size() : 1;
+    bool isSaturated = bodySize > 0 && remaining > (UINT64_MAX - m_statementCount) / bodySize;
+    m_statementCount = isSaturated ? UINT64_MAX : m_statementCount + remaining * bodySize;
+    CheckLimits();
+
+    AffineTransform body(slots.size());
+    AppendToTransform(loop->GetCode().get(), slots, body);
+    std::vector<int64_t> values;
+    for (uint32_t slot : slots) {
+      values.emplace_back(m_variables.Get(slot));
+    }
+
+    body.Power(remaining).Apply(values);
+    for (size_t i = 0; i < slots.size(); ++i) {
+      BeforeWrite(node, slots[i], values[i]);
+      m_variables.At(slots[i]) = values[i];
+    }
+  }
+
+  void EvaluateStatementAffineModification(const AstNodeStatementAffineModification* node) {
+    if (m_shouldTerminate) {
+      return;
+    }
+
+    uint32_t slot = node->GetTargetSlot();
+    if (node->RequiresTarget() && !m_variables.IsDefined(slot)) {
+      throw ExecutionException("Undefined variable.");
+    }
+
+    int64_t value = node->GetAddend();
+    if (node->HasSource()) {
+      uint32_t sourceSlot = node->GetSourceSlot();
+      if (!m_variables.IsDefined(sourceSlot)) {
+        throw ExecutionException("Undefined variable.");
+      }
+
+      value = WrappingAdd(WrappingMultiply(m_variables.Get(sourceSlot), node->GetMultiplier()), value);
+    }
+
+    BeforeWrite(node, slot, value);
+    m_variables.Set(slot, value);
+  }
+
+  // Body of an affine loop as a transform over its slots, other variables are read as constants
+  void AppendToTransform(const AstNode* node, const std::vector<uint32_t>& slots, AffineTransform& transform) {
+    if (node->GetType() == AstNodeType::STATEMENT_CHAIN) {
+      for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+        AppendToTransform(statement.get(), slots, transform);
+      }
+
+      return;
+    }
+
+    // Passed in the first iteration, and a declared function stays declared
+    if (node->GetType() == AstNodeType::STATEMENT_CHECK_FUNCTION) {
+      return;
+    }
+
+    const auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+    if (!modification) {
+      throw ExecutionException("Unexpected node.");
+    }
+
+    auto indexOf = [&slots](uint32_t slot) {
+      return static_cast<size_t>(std::find(slots.begin(), slots.end(), slot) - slots.begin());
+    };
+
+    const AstNode* valueNode = modification->GetValue().get();
+    size_t valueIndex = valueNode->GetType() == AstNodeType::VALUE_IDENTIFIER
+    ? indexOf(valueNode->As<AstNodeValueIdentifier>()->GetSlot())
+    : slots.size();
+    AffineTransform::Row value = valueIndex < slots.size()
+    ? transform.GetRow(valueIndex)
+    : transform.MakeConstant(EvaluateValue(valueNode));
+
+    AffineTransform::Row& target = transform.GetRow(indexOf(modification->GetSlot()));
+    switch (modification->GetOperatorType()) {
+      case ModificationOperatorType::ADD: {
+        for (size_t i = 0; i < target.size(); ++i) {
+          target[i] += value[i];
+        }
+
+        return;
+      }
+      case ModificationOperatorType::SUBTRACT: {
+        for (size_t i = 0; i < target.size(); ++i) {
+          target[i] -= value[i];
+        }
+
+        return;
+      }
+      case ModificationOperatorType::MULTIPLY: {
+        // Optimizer guarantees the factor is a constant or a loop invariant
+        for (uint64_t& coefficient : target) {
+          coefficient *= value.back();
+        }
+
+        return;
+      }
+      case ModificationOperatorType::ASSIGN: {
+        target = value;
+        return;
+      }
+      default: throw ExecutionException("Unexpected node.");
     }
   }
 
@@ -218,6 +863,19 @@ private:
       return;
     }
 
+    // Chains have no position of their own, their statements are reported one by one
+    if (kHasHooks && node->GetType() != AstNodeType::STATEMENT_CHAIN) {
+      m_hooks.OnStatement(node);
+      m_hooks.OnEnter(node);
+      DispatchStatement(node);
+      m_hooks.OnExit(node);
+      return;
+    }
+
+    DispatchStatement(node);
+  }
+
+  void DispatchStatement(const AstNode* node) {
     if (node->GetType() == AstNodeType::STATEMENT_CHAIN) {
       EvaluateStatementChain(node->As<AstNodeStatementChain>());
       return;
@@ -258,13 +916,44 @@ private:
       return;
     }
 
+    if (node->GetType() == AstNodeType::STATEMENT_AFFINE_LOOP) {
+      EvaluateStatementAffineLoop(node->As<AstNodeStatementAffineLoop>());
+      return;
+    }
+
+    if (node->GetType() == AstNodeType::STATEMENT_AFFINE_MODIFICATION) {
+      EvaluateStatementAffineModification(node->As<AstNodeStatementAffineModification>());
+      return;
+    }
+
+    if (node->GetType() == AstNodeType::STATEMENT_CHECK_FUNCTION) {
+      EvaluateStatementCheckFunction(node->As<AstNodeStatementCheckFunction>());
+      return;
+    }
+
     throw ExecutionException("Unexpected node.");
   }
 
 private:
+  InterpreterOptions m_options;
+  [[no_unique_address]] Hooks m_hooks;
   bool m_shouldTerminate = false;
-  // Print should print variables in order
-  std::list<Variable> m_values;
-  std::unordered_map<std::string, std::list<Variable>::iterator> m_variables;
-  std::unordered_map<std::string, std::shared_ptr<AstNode>> m_functions;
+  // Never change, shared by forks
+  std::shared_ptr<const SymbolTable> m_variableNames;
+  std::shared_ptr<const SymbolTable> m_functionNames;
+  // Print should print variables in order, the storage keeps it
+  PersistentVariableStorage m_variables;
+  std::shared_ptr<Bindings> m_bindings;
+  // A fork refers to them as well, copied before the next declaration
+  bool m_isBindingsShared = false;
+  std::vector<Frame> m_frames;
+  OutputSink* m_output;
+  FunctionCompiler* m_functionCompiler = nullptr;
+  // Null unless enabled, a fork gets one of its own that starts cold
+  std::unique_ptr<NativeTier> m_nativeTier;
+  uint64_t m_stepCount = 0;
+  uint64_t m_statementCount = 0;
+  uint32_t m_callDepth = 0;
 };
+
+using Interpreter = BasicInterpreter<>;
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "AstNodes.hpp"
+#include "Profiler.hpp"
+#include "Tracer.hpp"
+
+/*
+
+Interpreter hooks
+
+BasicInterpreter<Hooks> calls its hooks object at fixed points of a run. Calls are resolved at
+compile time and inlined, so NoHooks costs nothing and a custom policy costs only what it does:
+no virtual call, no null check. A policy has all of the functions below, usually by deriving from
+NoHooks and hiding the ones it needs:
+
+  OnStatement(node)                          before a statement runs, chains aren't statements
+  OnEnter(node), OnExit(node)                around the whole run of a statement, its block included.
+                                             Always paired and nested, unless the run fails
+  OnIterations(node, count)                  loop passes about to run, inside the loop's OnEnter
+  OnCall(node)                               before a call, the function may turn out undefined
+  OnWrite(node, slot, isDefined, old, new)   before a variable is assigned, isDefined is false for
+                                             a declaration (old is 0 then)
+  OnDelete(node, slot, value)                before a variable is deleted
+
+A hook may throw (LimitExceededException for a budget, say), the run fails as if the statement had.
+Hooks aren't told about anything that doesn't run in the tree, so an interpreter with hooks never
+tiers up to native code. Forks get a copy of the hooks, so the policies below report a fork to the
+same profiler or tracer as its parent.
+
+Profiling and tracing are policies like any other, CombinedHooks runs two of them.
+
+*/
+
+struct NoHooks {
+  void OnStatement(const AstNode*) {
+  }
+
+  void OnEnter(const AstNode*) {
+  }
+
+  void OnExit(const AstNode*) {
+  }
+
+  void OnIterations(const AstNode*, uint64_t) {
+  }
+
+  void OnCall(const AstNodeStatementCall*) {
+  }
+
+  void OnWrite(const AstNode*, uint32_t, bool, int64_t, int64_t) {
+  }
+
+  void OnDelete(const AstNode*, uint32_t, int64_t) {
+  }
+};
+
+// Reports every statement to the profiler, which has to outlive the interpreter
+struct ProfilerHooks : NoHooks {
+  explicit ProfilerHooks(Profiler* profiler)
+  : m_profiler(profiler) {
+  }
+
+  void OnEnter(const AstNode* node) {
+    m_profiler->Enter(node);
+  }
+
+  void OnExit(const AstNode*) {
+    m_profiler->Exit();
+  }
+
+  void OnIterations(const AstNode*, uint64_t count) {
+    m_profiler->CountIterations(count);
+  }
+
+private:
+  Profiler* m_profiler;
+};
+
+// Records every variable write, delete and call, the tracer has to outlive the interpreter
+struct TracerHooks : NoHooks {
+  explicit TracerHooks(Tracer* tracer)
+  : m_tracer(tracer) {
+  }
+
+  void OnCall(const AstNodeStatementCall* node) {
+    m_tracer->Record(node, TraceEvent::CALL, node->GetSlot(), 0, 0);
+  }
+
+  void OnWrite(const AstNode* node, uint32_t slot, bool isDefined, int64_t oldValue, int64_t newValue) {
+    m_tracer->Record(node, isDefined ? TraceEvent::WRITE : TraceEvent::DECLARE, slot, oldValue, newValue);
+  }
+
+  void OnDelete(const AstNode* node, uint32_t slot, int64_t value) {
+    m_tracer->Record(node, TraceEvent::DELETE, slot, value, 0);
+  }
+
+private:
+  Tracer* m_tracer;
+};
+
+// First's hooks, then Second's
+template <typename First, typename Second>
+struct CombinedHooks {
+  CombinedHooks(First first, Second second)
+  : m_first(std::move(first))
+  , m_second(std::move(second)) {
+  }
+
+  void OnStatement(const AstNode* node) {
+    m_first.OnStatement(node);
+    m_second.OnStatement(node);
+  }
+
+  void OnEnter(const AstNode* node) {
+    m_first.OnEnter(node);
+    m_second.OnEnter(node);
+  }
+
+  // Reversed, so the two stay nested
+  void OnExit(const AstNode* node) {
+    m_second.OnExit(node);
+    m_first.OnExit(node);
+  }
+
+  void OnIterations(const AstNode* node, uint64_t count) {
+    m_first.OnIterations(node, count);
+    m_second.OnIterations(node, count);
+  }
+
+  void OnCall(const AstNodeStatementCall* node) {
+    m_first.OnCall(node);
+    m_second.OnCall(node);
+  }
+
+  void OnWrite(const AstNode* node, uint32_t slot, bool isDefined, int64_t oldValue, int64_t newValue) {
+    m_first.OnWrite(node, slot, isDefined, oldValue, newValue);
+    m_second.OnWrite(node, slot, isDefined, oldValue, newValue);
+  }
+
+  void OnDelete(const AstNode* node, uint32_t slot, int64_t value) {
+    m_first.OnDelete(node, slot, value);
+    m_second.OnDelete(node, slot, value);
+  }
+
+  [[nodiscard]] First& GetFirst() {
+    return m_first;
+  }
+
+  [[nodiscard]] Second& GetSecond() {
+    return m_second;
+  }
+
+private:
+  [[no_unique_address]] First m_first;
+  [[no_unique_address]] Second m_second;
+};
@@ -0,0 +1,580 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "Bytecode.hpp"
+#include "VariableStorage.hpp"
+#include "X86Assembler.hpp"
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/*
+
+JIT for hot regions of bytecode
+
+Region = a loop (LOOP_BEGIN up to its exit) or a function body (entry up to its RETURN).
+Only regions made of assignments, add/sub/mult, compare-and-branch, nested loops and inlined call
+guards are compiled, anything else (print, delete, calls, declarations) stays in the VirtualMachine.
+
+A region is entered natively only when every variable it touches is already defined and every
+function it guards is already bound (nothing inside of a region can declare one). In that case
+it can neither throw nor declare anything, so it boils down to integer arithmetic over a fixed
+set of slots. Those slots and the loop counters live in registers for the whole region
+and are written back to VariableStorage on exit.
+
+*/
+
+// Native code lives in its own pages, mapped writable first and executable afterwards
+struct ExecutableMemory final {
+  ExecutableMemory() = default;
+  ExecutableMemory(const ExecutableMemory&) = delete;
+  ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+  ~ExecutableMemory() {
+#if JIT_SUPPORTED
+    for (auto [address, size] : m_mappings) {
+      munmap(address, size);
+    }
+#endif
+  }
+
+  void* Allocate(const std::vector<uint8_t>& code) {
+#if JIT_SUPPORTED
+    auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED) {
+      return nullptr;
+    }
+
+    std::memcpy(address, code.data(), code.size());
+    if (mprotect(address, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(address, size);
+      return nullptr;
+    }
+
+    m_mappings.emplace_back(address, size);
+    return address;
+#else
+    return nullptr;
+#endif
+  }
+
+private:
+  std::vector<std::pair<void*, size_t>> m_mappings;
+};
+
+struct JitOptions final {
+  // Loops heat up by their trip count, functions by one per call
+  uint64_t hotLoopIterations = 1000;
+  uint64_t hotFunctionCalls = 100;
+};
+
+struct Jit final {
+  static constexpr bool kIsSupported = JIT_SUPPORTED;
+
+  explicit Jit(const BytecodeProgram& program, JitOptions options = {})
+  : m_program(program)
+  , m_options(options)
+  , m_regionIndices(program.code.size(), kNoRegion) {
+  }
+
+  // Both return false when the region has to be interpreted instead
+
+  // functions maps function slot -> body entry, kUnboundFunction if not declared yet
+
+  bool TryExecuteLoop(uint32_t begin, int64_t tripCount, VariableStorage& variables, const std::vector<uint32_t>& functions) {
+    return TryExecute(begin, false, static_cast<uint64_t>(tripCount), m_options.hotLoopIterations, variables, functions);
+  }
+
+  bool TryExecuteFunction(uint32_t entry, VariableStorage& variables, const std::vector<uint32_t>& functions) {
+    return TryExecute(entry, true, 1, m_options.hotFunctionCalls, variables, functions);
+  }
+
+  [[nodiscard]] size_t GetCompiledRegionCount() const {
+    return std::count_if(m_regions.begin(), m_regions.end(), [](const Region& region) {
+      return region.status == RegionStatus::COMPILED;
+    });
+  }
+
+private:
+  using NativeFunction = void (*)(int64_t* values);
+
+  static constexpr uint32_t kNoRegion = UINT32_MAX;
+
+  enum struct RegionStatus : uint8_t {
+    COLD,
+    UNSUPPORTED,
+    COMPILED
+  };
+
+  struct Region final {
+    RegionStatus status = RegionStatus::COLD;
+    uint64_t hotness = 0;
+    NativeFunction function = nullptr;
+    // Have to be defined on entry
+    std::vector<uint32_t> slots;
+    // Have to be bound on entry
+    std::vector<uint32_t> functions;
+  };
+
+  bool TryExecute(uint32_t start, bool isFunction, uint64_t heat, uint64_t threshold, VariableStorage& variables, const std::vector<uint32_t>& functions) {
+    uint32_t& index = m_regionIndices[start];
+    if (index == kNoRegion) {
+      index = static_cast<uint32_t>(m_regions.size());
+      m_regions.emplace_back();
+    }
+
+    Region& region = m_regions[index];
+    if (region.status == RegionStatus::UNSUPPORTED) {
+      return false;
+    }
+
+    if (region.status == RegionStatus::COLD) {
+      region.hotness += heat;
+      if (region.hotness < threshold) {
+        return false;
+      }
+
+      Compile(region, start, isFunction);
+      if (region.status != RegionStatus::COMPILED) {
+        return false;
+      }
+    }
+
+    for (uint32_t slot : region.slots) {
+      if (!variables.IsDefined(slot)) {
+        return false;
+      }
+    }
+
+    for (uint32_t slot : region.functions) {
+      if (functions[slot] == kUnboundFunction) {
+        return false;
+      }
+    }
+
+    region.function(variables.GetValues());
+    return true;
+  }
+
+  static bool IsSupportedInstruction(OpCode opCode) {
+    switch (opCode) {
+      case OpCode::ASSIGN_CONST:
+      case OpCode::ASSIGN_VAR:
+      case OpCode::ADD_CONST:
+      case OpCode::ADD_VAR:
+      case OpCode::SUB_CONST:
+      case OpCode::SUB_VAR:
+      case OpCode::MULT_CONST:
+      case OpCode::MULT_VAR:
+      case OpCode::JUMP:
+      case OpCode::JUMP_IF_EQUAL_CONST:
+      case OpCode::JUMP_IF_EQUAL_VAR:
+      case OpCode::JUMP_IF_NOT_EQUAL_CONST:
+      case OpCode::JUMP_IF_NOT_EQUAL_VAR:
+      case OpCode::LOOP_BEGIN_CONST:
+      case OpCode::LOOP_BEGIN_VAR:
+      case OpCode::LOOP_NEXT:
+      case OpCode::CHECK_FUNCTION:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  static bool HasTarget(OpCode opCode) {
+    switch (opCode) {
+      case OpCode::JUMP:
+      case OpCode::JUMP_IF_EQUAL_CONST:
+      case OpCode::JUMP_IF_EQUAL_VAR:
+      case OpCode::JUMP_IF_NOT_EQUAL_CONST:
+      case OpCode::JUMP_IF_NOT_EQUAL_VAR:
+      case OpCode::LOOP_BEGIN_CONST:
+      case OpCode::LOOP_BEGIN_VAR:
+      case OpCode::LOOP_NEXT:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Slots read or written by the instruction. Loop counters aren't slots
+  static void CollectSlots(const Instruction& instruction, std::vector<uint32_t>& slots) {
+    switch (instruction.opCode) {
+      case OpCode::ASSIGN_CONST:
+      case OpCode::ADD_CONST:
+      case OpCode::SUB_CONST:
+      case OpCode::MULT_CONST:
+      case OpCode::JUMP_IF_EQUAL_CONST:
+      case OpCode::JUMP_IF_NOT_EQUAL_CONST:
+      case OpCode::LOOP_BEGIN_VAR:
+        slots.emplace_back(instruction.slot);
+        return;
+      case OpCode::ASSIGN_VAR:
+      case OpCode::ADD_VAR:
+      case OpCode::SUB_VAR:
+      case OpCode::MULT_VAR:
+      case OpCode::JUMP_IF_EQUAL_VAR:
+      case OpCode::JUMP_IF_NOT_EQUAL_VAR:
+        slots.emplace_back(instruction.slot);
+        slots.emplace_back(instruction.operand);
+        return;
+      default:
+        return;
+    }
+  }
+
+  void Compile(Region& region, uint32_t start, bool isFunction) {
+    region.status = RegionStatus::UNSUPPORTED;
+    if (!kIsSupported) {
+      return;
+    }
+
+    // [start, end). Jumps to end leave the region
+    const auto& code = m_program.code;
+    uint32_t end = start;
+    if (isFunction) {
+      while (end < code.size() && code[end].opCode != OpCode::RETURN) {
+        ++end;
+      }
+    } else {
+      end = code[start].target;
+    }
+
+    if (end > code.size()) {
+      return;
+    }
+
+    std::vector<uint32_t> depths(end - start, 0);
+    std::vector<uint32_t> functions;
+    uint32_t depth = 0;
+    uint32_t maxDepth = 0;
+    for (uint32_t pc = start; pc < end; ++pc) {
+      const Instruction& instruction = code[pc];
+      if (!IsSupportedInstruction(instruction.opCode)) {
+        return;
+      }
+
+      if (instruction.opCode == OpCode::CHECK_FUNCTION
+      && std::find(functions.begin(), functions.end(), instruction.slot) == functions.end()) {
+        functions.emplace_back(instruction.slot);
+      }
+
+      if (HasTarget(instruction.opCode) && (instruction.target < start || instruction.target > end)) {
+        return;
+      }
+
+      if (instruction.opCode == OpCode::LOOP_NEXT) {
+        if (depth == 0) {
+          return;
+        }
+
+        --depth;
+      }
+
+      depths[pc - start] = depth;
+      if (instruction.opCode == OpCode::LOOP_BEGIN_CONST || instruction.opCode == OpCode::LOOP_BEGIN_VAR) {
+        maxDepth = std::max(maxDepth, ++depth);
+      }
+    }
+
+    if (depth != 0) {
+      return;
+    }
+
+    Allocation allocation = Allocate(start, end, depths, maxDepth);
+    X86Assembler assembler;
+    EmitRegion(assembler, allocation, start, end, depths);
+    auto* function = reinterpret_cast<NativeFunction>(m_memory.Allocate(assembler.GetCode()));
+    if (!function) {
+      return;
+    }
+
+    region.slots = std::move(allocation.slots);
+    region.functions = std::move(functions);
+    region.function = function;
+    region.status = RegionStatus::COMPILED;
+  }
+
+  struct Allocation final {
+    std::vector<uint32_t> slots;
+    std::vector<std::pair<uint32_t, Register>> slotRegisters;
+    // Indexed by nesting depth
+    std::vector<Location> counters;
+    std::vector<Register> calleeSaved;
+    int32_t spilledCounters = 0;
+  };
+
+  static bool IsCalleeSaved(Register reg) {
+    return reg == Register::RBX || reg >= Register::R12;
+  }
+
+  // Hotter = more deeply nested. Registers go to the hottest slots and counters,
+  // the rest is addressed in memory. RAX and RDX are scratch, RDI holds the values pointer
+  Allocation Allocate(uint32_t start, uint32_t end, const std::vector<uint32_t>& depths, uint32_t maxDepth) {
+    static constexpr Register kPool[] = {
+      Register::RCX, Register::RSI, Register::R8, Register::R9, Register::R10, Register::R11,
+      Register::RBX, Register::R12, Register::R13, Register::R14, Register::R15
+    };
+
+    auto heat = [](uint32_t depth) {
+      return uint64_t(1) << std::min<uint32_t>(3 * depth, 60);
+    };
+
+    struct Candidate final {
+      uint64_t weight;
+      bool isCounter;
+      uint32_t index;
+    };
+
+    std::vector<Candidate> candidates;
+    std::vector<uint32_t> slots;
+    for (uint32_t pc = start; pc < end; ++pc) {
+      std::vector<uint32_t> used;
+      CollectSlots(m_program.code[pc], used);
+      for (uint32_t slot : used) {
+        auto iter = std::find_if(candidates.begin(), candidates.end(), [slot](const Candidate& candidate) {
+          return !candidate.isCounter && candidate.index == slot;
+        });
+        if (iter == candidates.end()) {
+          candidates.emplace_back(0, false, slot);
+          slots.emplace_back(slot);
+          iter = candidates.end() - 1;
+        }
+
+        iter->weight += heat(depths[pc - start]);
+      }
+    }
+
+    for (uint32_t counter = 0; counter < maxDepth; ++counter) {
+      candidates.emplace_back(heat(counter + 1) * 2, true, counter);
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& left, const Candidate& right) {
+      return left.weight > right.weight;
+    });
+
+    Allocation allocation;
+    allocation.slots = std::move(slots);
+    allocation.counters.resize(maxDepth, Location::InRegister(Register::RAX));
+    size_t nextRegister = 0;
+    for (const Candidate& candidate : candidates) {
+      if (nextRegister < std::size(kPool)) {
+        Register reg = kPool[nextRegister++];
+        if (IsCalleeSaved(reg)) {
+          allocation.calleeSaved.emplace_back(reg);
+        }
+
+        if (candidate.isCounter) {
+          allocation.counters[candidate.index] = Location::InRegister(reg);
+        } else {
+          allocation.slotRegisters.emplace_back(candidate.index, reg);
+        }
+
+        continue;
+      }
+
+      if (candidate.isCounter) {
+        allocation.counters[candidate.index] = Location::InMemory(Register::RSP, 8 * allocation.spilledCounters++);
+      }
+    }
+
+    return allocation;
+  }
+
+  static Location GetSlotLocation(const Allocation& allocation, uint32_t slot) {
+    for (auto [allocatedSlot, reg] : allocation.slotRegisters) {
+      if (allocatedSlot == slot) {
+        return Location::InRegister(reg);
+      }
+    }
+
+    return Location::InMemory(Register::RDI, static_cast<int32_t>(8 * slot));
+  }
+
+  // Register holding the slot's value, loading it into scratch if needed
+  static Register LoadSlot(X86Assembler& assembler, const Location& location, Register scratch) {
+    if (location.isRegister) {
+      return location.reg;
+    }
+
+    assembler.Mov(scratch, location);
+    return scratch;
+  }
+
+  static void EmitAssignConst(X86Assembler& assembler, const Location& destination, int64_t value) {
+    if (X86Assembler::FitsInt32(value)) {
+      assembler.MovImmediate(destination, static_cast<int32_t>(value));
+      return;
+    }
+
+    assembler.MovRegisterImmediate(Register::RAX, value);
+    assembler.Mov(destination, Register::RAX);
+  }
+
+  static void EmitMultiply(X86Assembler& assembler, const Location& destination, const Instruction& instruction, const Allocation& allocation) {
+    Register target = destination.isRegister ? destination.reg : Register::RDX;
+    assembler.Mov(target, destination);
+    if (instruction.opCode == OpCode::MULT_CONST) {
+      if (X86Assembler::FitsInt32(instruction.immediate)) {
+        assembler.Imul(target, Location::InRegister(target), static_cast<int32_t>(instruction.immediate));
+      } else {
+        assembler.MovRegisterImmediate(Register::RAX, instruction.immediate);
+        assembler.Imul(target, Location::InRegister(Register::RAX));
+      }
+    } else {
+      assembler.Imul(target, GetSlotLocation(allocation, instruction.operand));
+    }
+
+    assembler.Mov(destination, target);
+  }
+
+  void EmitRegion(X86Assembler& assembler, const Allocation& allocation, uint32_t start, uint32_t end, const std::vector<uint32_t>& depths) {
+    // Prologue
+    for (Register reg : allocation.calleeSaved) {
+      assembler.Push(reg);
+    }
+
+    if (allocation.spilledCounters > 0) {
+      assembler.Sub(Location::InRegister(Register::RSP), 8 * allocation.spilledCounters);
+    }
+
+    for (auto [slot, reg] : allocation.slotRegisters) {
+      assembler.Mov(reg, Location::InMemory(Register::RDI, static_cast<int32_t>(8 * slot)));
+    }
+
+    std::vector<size_t> positions(end - start + 1, 0);
+    std::vector<std::pair<size_t, uint32_t>> fixups;
+    auto jumpTo = [&fixups](size_t field, uint32_t target) {
+      fixups.emplace_back(field, target);
+    };
+
+    for (uint32_t pc = start; pc < end; ++pc) {
+      positions[pc - start] = assembler.GetPosition();
+      const Instruction& instruction = m_program.code[pc];
+      Location destination = GetSlotLocation(allocation, instruction.slot);
+      switch (instruction.opCode) {
+        case OpCode::ASSIGN_CONST: {
+          EmitAssignConst(assembler, destination, instruction.immediate);
+          break;
+        }
+        case OpCode::ASSIGN_VAR: {
+          Register source = LoadSlot(assembler, GetSlotLocation(allocation, instruction.operand), Register::RAX);
+          assembler.Mov(destination, source);
+          break;
+        }
+        case OpCode::ADD_CONST:
+        case OpCode::SUB_CONST: {
+          bool isAdd = instruction.opCode == OpCode::ADD_CONST;
+          if (X86Assembler::FitsInt32(instruction.immediate)) {
+            auto value = static_cast<int32_t>(instruction.immediate);
+            isAdd ? assembler.Add(destination, value) : assembler.Sub(destination, value);
+            break;
+          }
+
+          assembler.MovRegisterImmediate(Register::RAX, instruction.immediate);
+          isAdd ? assembler.Add(destination, Register::RAX) : assembler.Sub(destination, Register::RAX);
+          break;
+        }
+        case OpCode::ADD_VAR:
+        case OpCode::SUB_VAR: {
+          Register source = LoadSlot(assembler, GetSlotLocation(allocation, instruction.operand), Register::RAX);
+          instruction.opCode == OpCode::ADD_VAR ? assembler.Add(destination, source) : assembler.Sub(destination, source);
+          break;
+        }
+        case OpCode::MULT_CONST:
+        case OpCode::MULT_VAR: {
+          EmitMultiply(assembler, destination, instruction, allocation);
+          break;
+        }
+        case OpCode::JUMP: {
+          jumpTo(assembler.Jmp(), instruction.target);
+          break;
+        }
+        case OpCode::JUMP_IF_EQUAL_CONST:
+        case OpCode::JUMP_IF_NOT_EQUAL_CONST: {
+          if (X86Assembler::FitsInt32(instruction.immediate)) {
+            assembler.Cmp(destination, static_cast<int32_t>(instruction.immediate));
+          } else {
+            assembler.MovRegisterImmediate(Register::RAX, instruction.immediate);
+            assembler.Cmp(destination, Register::RAX);
+          }
+
+          bool isEqual = instruction.opCode == OpCode::JUMP_IF_EQUAL_CONST;
+          jumpTo(assembler.Jcc(isEqual ? Condition::EQUAL : Condition::NOT_EQUAL), instruction.target);
+          break;
+        }
+        case OpCode::JUMP_IF_EQUAL_VAR:
+        case OpCode::JUMP_IF_NOT_EQUAL_VAR: {
+          Register right = LoadSlot(assembler, GetSlotLocation(allocation, instruction.operand), Register::RAX);
+          assembler.Cmp(destination, right);
+          bool isEqual = instruction.opCode == OpCode::JUMP_IF_EQUAL_VAR;
+          jumpTo(assembler.Jcc(isEqual ? Condition::EQUAL : Condition::NOT_EQUAL), instruction.target);
+          break;
+        }
+        case OpCode::LOOP_BEGIN_CONST:
+        case OpCode::LOOP_BEGIN_VAR: {
+          const Location& counter = allocation.counters[depths[pc - start]];
+          if (instruction.opCode == OpCode::LOOP_BEGIN_CONST) {
+            EmitAssignConst(assembler, counter, instruction.immediate);
+          } else {
+            assembler.Mov(counter, LoadSlot(assembler, destination, Register::RAX));
+          }
+
+          assembler.Cmp(counter, 0);
+          jumpTo(assembler.Jcc(Condition::LESS_EQUAL), instruction.target);
+          break;
+        }
+        case OpCode::LOOP_NEXT: {
+          const Location& counter = allocation.counters[depths[pc - start]];
+          assembler.Sub(counter, 1);
+          jumpTo(assembler.Jcc(Condition::GREATER), instruction.target);
+          break;
+        }
+        case OpCode::CHECK_FUNCTION: {
+          // Checked once on entry
+          break;
+        }
+        default: break;
+      }
+    }
+
+    // Epilogue
+    positions[end - start] = assembler.GetPosition();
+    for (auto [slot, reg] : allocation.slotRegisters) {
+      assembler.Mov(Location::InMemory(Register::RDI, static_cast<int32_t>(8 * slot)), reg);
+    }
+
+    if (allocation.spilledCounters > 0) {
+      assembler.Add(Location::InRegister(Register::RSP), 8 * allocation.spilledCounters);
+    }
+
+    for (auto iter = allocation.calleeSaved.rbegin(); iter != allocation.calleeSaved.rend(); ++iter) {
+      assembler.Pop(*iter);
+    }
+
+    assembler.Ret();
+
+    for (auto [field, target] : fixups) {
+      assembler.PatchJump(field, positions[target - start]);
+    }
+  }
+
+private:
+  const BytecodeProgram& m_program;
+  JitOptions m_options;
+  // Bytecode position -> index in m_regions
+  std::vector<uint32_t> m_regionIndices;
+  std::vector<Region> m_regions;
+  ExecutableMemory m_memory;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Arithmetic.hpp"
+#include "AstNodes.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LANE_KERNELS_AVX2 1
+#else
+#define LANE_KERNELS_AVX2 0
+#endif
+
+// Masked operations over arrays of int64 lanes, used by BatchInterpreter. A mask lane is -1 if
+// the lane takes part and 0 otherwise, lanes outside of the mask are never written.
+// AVX2 is picked at runtime when the CPU has it, the scalar loops are the fallback and handle the tails
+
+inline int64_t ModifyLane(ModificationOperatorType opType, int64_t target, int64_t value) {
+  switch (opType) {
+    case ModificationOperatorType::ADD: return WrappingAdd(target, value);
+    case ModificationOperatorType::SUBTRACT: return WrappingSubtract(target, value);
+    case ModificationOperatorType::MULTIPLY: return WrappingMultiply(target, value);
+    default: return value;
+  }
+}
+
+#if LANE_KERNELS_AVX2
+inline bool HasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+
+// AVX2 has no 64 bit multiply: a * b = lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32) mod 2^64
+__attribute__((target("avx2"))) inline __m256i MultiplyLanesAvx2(__m256i left, __m256i right) {
+  __m256i low = _mm256_mul_epu32(left, right);
+  __m256i cross = _mm256_add_epi64(
+    _mm256_mul_epu32(_mm256_srli_epi64(left, 32), right),
+    _mm256_mul_epu32(left, _mm256_srli_epi64(right, 32)));
+  return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+// Returns how many lanes were processed
+__attribute__((target("avx2"))) inline size_t MaskedModifyAvx2(ModificationOperatorType opType, int64_t* target,
+  const int64_t* value, const int64_t* mask, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i targetLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+    __m256i valueLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(value + i));
+    __m256i maskLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i));
+    __m256i result = valueLanes;
+    switch (opType) {
+      case ModificationOperatorType::ADD: result = _mm256_add_epi64(targetLanes, valueLanes); break;
+      case ModificationOperatorType::SUBTRACT: result = _mm256_sub_epi64(targetLanes, valueLanes); break;
+      case ModificationOperatorType::MULTIPLY: result = MultiplyLanesAvx2(targetLanes, valueLanes); break;
+      default: break;
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_blendv_epi8(targetLanes, result, maskLanes));
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) inline size_t MaskedCompareAvx2(bool isEqual, const int64_t* left, const int64_t* right,
+  const int64_t* mask, int64_t* result, size_t count) {
+  __m256i invert = isEqual ? _mm256_setzero_si256() : _mm256_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i leftLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + i));
+    __m256i rightLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(right + i));
+    __m256i maskLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i));
+    __m256i equal = _mm256_xor_si256(_mm256_cmpeq_epi64(leftLanes, rightLanes), invert);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(result + i), _mm256_and_si256(equal, maskLanes));
+  }
+
+  return i;
+}
+#endif
+
+// target = target op value in every masked lane
+inline void MaskedModify(ModificationOperatorType opType, int64_t* target, const int64_t* value, const int64_t* mask, size_t count) {
+  size_t i = 0;
+#if LANE_KERNELS_AVX2
+  if (HasAvx2()) {
+    i = MaskedModifyAvx2(opType, target, value, mask, count);
+  }
+#endif
+
+  for (; i < count; ++i) {
+    if (mask[i]) {
+      target[i] = ModifyLane(opType, target[i], value[i]);
+    }
+  }
+}
+
+// result = mask & (left == right), or != unless isEqual
+inline void MaskedCompare(bool isEqual, const int64_t* left, const int64_t* right, const int64_t* mask, int64_t* result, size_t count) {
+  size_t i = 0;
+#if LANE_KERNELS_AVX2
+  if (HasAvx2()) {
+    i = MaskedCompareAvx2(isEqual, left, right, mask, result, count);
+  }
+#endif
+
+  for (; i < count; ++i) {
+    result[i] = (left[i] == right[i]) == isEqual ? mask[i] : 0;
+  }
+}
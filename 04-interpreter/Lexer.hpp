@@ -103,8 +103,17 @@ struct Lexer final {
 
 private:
   template <typename Type, typename... Args>
-  void PushToken(Args... args) requires(std::constructible_from<Type, Args...>) {
+  void PushToken(SourcePosition position, Args... args) requires(std::constructible_from<Type, Args...>) {
     m_tokens.emplace_back(std::make_unique<Type>(args...));
+    m_tokens.back()->SetSourcePosition(position);
+  }
+
+  static SourcePosition PositionOf(const LexerView& view) {
+    return SourcePosition(static_cast<uint32_t>(view.GetLine()), static_cast<uint32_t>(view.GetColumn()));
+  }
+
+  static SourcePosition PositionOf(const TokenRecorder& recorder) {
+    return SourcePosition(static_cast<uint32_t>(recorder.GetLine()), static_cast<uint32_t>(recorder.GetColumn()));
   }
 
   // If a tokenizer function fails, the position shouldn't change
@@ -128,6 +137,7 @@ private:
 
   bool ResolveNumber(LexerView& view) {
     bool isPositive = true;
+    SourcePosition position = PositionOf(view);
     return Matcher(view)
     .Perform([this, &isPositive](LexerView& view) {
       if (view.Match(IsSign)) {
@@ -139,13 +149,13 @@ private:
     })
     .Record()
     .Many(isdigit)
-    .CollectTokenRecorder([this, isPositive](const auto& recorder) {
+    .CollectTokenRecorder([this, isPositive, position](const auto& recorder) {
       try {
         auto view = recorder.GetTokenView();
         int64_t number = std::stoll(std::string(view));
         // TODO possible overflow
         number = isPositive ? number : -number;
-        PushToken<TokenNumber>(number);
+        PushToken<TokenNumber>(position, number);
         return true;
       } catch (const std::exception&) {
         return false;
@@ -162,15 +172,16 @@ private:
        return false;
       }
 
-      PushToken<TokenIdentifier>(std::string(view));
+      PushToken<TokenIdentifier>(PositionOf(recorder), std::string(view));
       return true;
     });
   }
 
   template <typename SimpleTokenType>
   bool ResolveSimpleKeyword(std::string_view token, LexerView& view) {
-    return Matcher(view).Any(token).Perform([this](LexerView& view) {
-      PushToken<SimpleTokenType>();
+    SourcePosition position = PositionOf(view);
+    return Matcher(view).Any(token).Perform([this, position](LexerView& view) {
+      PushToken<SimpleTokenType>(position);
     });
   }
 
@@ -202,13 +213,17 @@ private:
   }
 
   bool ResolveFragmentCall(LexerView& view) {
+    SourcePosition position;
     return Matcher(view)
     .AssertZeroMany(&Lexer::ResolveSkip, this)
+    .Perform([&position](LexerView& view) {
+      position = PositionOf(view);
+    })
     .Any('(')
     .AssertZeroMany(&Lexer::ResolveSkip, this)
     .Any(')')
-    .Perform([this](LexerView& view) {
-      PushToken<TokenCall>();
+    .Perform([this, &position](LexerView& view) {
+      PushToken<TokenCall>(position);
     });
   }
 
@@ -236,7 +251,7 @@ private:
     .Assert(&Lexer::ResolveStatementChain, this)
     .Perform([this](LexerView& view) {
       --m_nestingLevel;
-      PushToken<TokenBlockEnd>();
+      PushToken<TokenBlockEnd>(PositionOf(view));
       // TODO no need for that, if nesting == 0, NL will be consumed by the next statement chain
       // if (m_nestingLevel == 0) {
       //   view.Advance();
@@ -347,7 +362,7 @@ private:
     .Assert(&Lexer::ResolveStatementChain, this)
     .Perform([this](LexerView& view) {
       --m_nestingLevel;
-      PushToken<TokenBlockEnd>();
+      PushToken<TokenBlockEnd>(PositionOf(view));
     })
     .PerformIfFailed([this, &state](LexerView& view) {
       SetState(state);
@@ -369,7 +384,7 @@ private:
     .Assert(&Lexer::ResolveStatementChain, this)
     .Perform([this](LexerView& view) {
       --m_nestingLevel;
-      PushToken<TokenBlockEnd>();
+      PushToken<TokenBlockEnd>(PositionOf(view));
     })
     .PerformIfFailed([this, &state](LexerView& view) {
       SetState(state);
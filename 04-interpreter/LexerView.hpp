@@ -164,7 +164,8 @@ struct LexerView final {
 
   template <StringViewIsh... StringViews>
   [[nodiscard]] bool Match(const StringViews&... views) const {
-    return ((m_string.find(std::string_view { views }, m_position) == m_position) || ...);
+    // Only the symbols at the position are compared, find would scan the rest of the input on a mismatch
+    return m_position <= m_string.size() && (m_string.substr(m_position).starts_with(std::string_view { views }) || ...);
   }
 
   template <CharPredicate... Predicates>
@@ -236,7 +237,7 @@ struct LexerView final {
 
   template <typename... Chars>
   bool MatchAdvanceIgnoreCase(Chars... chars) requires(... && std::same_as<Chars, char>) {
-    if (MatchIgnoreCase(chars)) {
+    if (MatchIgnoreCase(chars...)) {
       Advance();
       return true;
     }
@@ -261,7 +262,7 @@ struct LexerView final {
   template <CharPredicate... Predicates>
   [[nodiscard]] std::string_view MatchExtractView(Predicates... predicates) const {
     size_t offset = 0;
-    while (HasSymbols(offset + 1) && predicates(Next(offset))) {
+    while (HasSymbols(offset + 1) && (predicates(Next(offset)) || ...)) {
       ++offset;
     }
 
@@ -273,7 +274,7 @@ struct LexerView final {
   }
 
   template <CharPredicate... Predicates>
-  [[nodiscard]] std::string_view MatchExtract(Predicates... predicates) const {
+  [[nodiscard]] std::string MatchExtract(Predicates... predicates) const {
     return std::string(MatchExtractView(predicates...));
   }
 
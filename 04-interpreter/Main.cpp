@@ -1,13 +1,185 @@
+#include <cstdlib>
+#include <charconv>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "BatchInterpreter.hpp"
+#include "Compiler.hpp"
+#include "CppTranspiler.hpp"
+#include "FunctionCompiler.hpp"
 #include "Interpreter.hpp"
 #include "Lexer.hpp"
 #include "Matcher.hpp"
+#include "Optimizer.hpp"
 #include "Parser.hpp"
+#include "PerfCounters.hpp"
+#include "Resolver.hpp"
+#include "Scheduler.hpp"
+#include "ThreadPool.hpp"
+#include "Tracer.hpp"
+#include "VirtualMachine.hpp"
+
+struct Options final {
+  bool useVirtualMachine = false;
+  bool useJit = false;
+  // Tree interpreter that compiles hot loops and functions to native code
+  bool useNativeTier = false;
+  bool inlineFunctions = false;
+  bool optimize = false;
+  InterpreterOptions interpreter;
+  // Transpile to this file instead of running
+  std::string emitCppPath;
+  // Run once per environment in this file, in lockstep
+  std::string batchPath;
+  // Run resumably on the scheduler in slices of this many steps
+  uint64_t sliceSteps = 0;
+  // Profile the tree interpreter, write a hot spot report and folded stacks here
+  std::string profilePath;
+  std::string foldedStacksPath;
+  // Trace the tree interpreter, write the latest records here when the run ends, failed or not
+  std::string tracePath;
+  // Count cycles, instructions and misses per phase, write a report and JSON here
+  std::string perfCountersPath;
+  std::string perfCountersJsonPath;
+  // Start from the state in this snapshot instead of an empty one
+  std::string loadSnapshotPath;
+  // Save the state after the run
+  std::string saveSnapshotPath;
+  // Run once per environment in this file, each on its own fork of the starting state
+  std::string whatIfPath;
+  size_t threadCount = std::thread::hardware_concurrency();
+};
+
+Options ParseOptions(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view argument = argv[i];
+    if (argument == "--vm") {
+      options.useVirtualMachine = true;
+      continue;
+    }
+
+    if (argument == "--jit") {
+      options.useVirtualMachine = true;
+      options.useJit = true;
+      continue;
+    }
+
+    if (argument == "--tiered") {
+      options.useNativeTier = true;
+      continue;
+    }
+
+    if (argument == "-O" || argument == "--optimize") {
+      options.optimize = true;
+      continue;
+    }
+
+    if (argument == "--inline") {
+      options.useVirtualMachine = true;
+      options.inlineFunctions = true;
+      continue;
+    }
+
+    if (argument == "--explicit-stack") {
+      options.interpreter.useExplicitStack = true;
+      continue;
+    }
+
+    if (argument == "--stack-limit" && i + 1 < argc) {
+      options.interpreter.useExplicitStack = true;
+      options.interpreter.maxStackBytes = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (argument == "--max-statements" && i + 1 < argc) {
+      options.interpreter.limits.maxStatements = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (argument == "--max-call-depth" && i + 1 < argc) {
+      options.interpreter.limits.maxCallDepth = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      continue;
+    }
+
+    if (argument == "--max-variables" && i + 1 < argc) {
+      options.interpreter.limits.maxLiveVariables = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (argument == "--slice" && i + 1 < argc) {
+      options.sliceSteps = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (argument == "--batch" && i + 1 < argc) {
+      options.batchPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--profile" && i + 1 < argc) {
+      options.profilePath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--profile-folded" && i + 1 < argc) {
+      options.foldedStacksPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--trace" && i + 1 < argc) {
+      options.tracePath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--perf-counters" && i + 1 < argc) {
+      options.perfCountersPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--perf-counters-json" && i + 1 < argc) {
+      options.perfCountersJsonPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--load-snapshot" && i + 1 < argc) {
+      options.loadSnapshotPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--save-snapshot" && i + 1 < argc) {
+      options.saveSnapshotPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--what-if" && i + 1 < argc) {
+      options.whatIfPath = argv[++i];
+      continue;
+    }
+
+    if (argument == "--threads" && i + 1 < argc) {
+      options.threadCount = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (argument == "--emit-cpp" && i + 1 < argc) {
+      options.emitCppPath = argv[++i];
+      continue;
+    }
+
+    std::cerr << "Unknown option: " << argument << '\n';
+  }
+
+  return options;
+}
 
 std::string GetInput() {
   std::stringstream ss;
@@ -19,6 +191,270 @@ std::string GetInput() {
   return ss.str();
 }
 
+std::shared_ptr<AstNode> ParseProgram(std::string_view source) {
+  Lexer lexer(source);
+  if (!lexer.Tokenize()) {
+    return nullptr;
+  }
+
+  return Parser(lexer.GetTokens()).Parse();
+}
+
+// Every function the program declares anywhere, whether the declaration runs or not
+void CollectFunctionNames(const AstNode* node, std::unordered_set<std::string>& names) {
+  switch (node->GetType()) {
+    case AstNodeType::STATEMENT_CHAIN: {
+      for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+        CollectFunctionNames(statement.get(), names);
+      }
+
+      return;
+    }
+    case AstNodeType::STATEMENT_FUNC_DECL: {
+      const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+      names.emplace(declaration->GetFunctionName());
+      CollectFunctionNames(declaration->GetCode().get(), names);
+      return;
+    }
+    case AstNodeType::STATEMENT_CONDITION: {
+      CollectFunctionNames(node->As<AstNodeStatementCondition>()->GetCode().get(), names);
+      return;
+    }
+    case AstNodeType::STATEMENT_LOOP: {
+      CollectFunctionNames(node->As<AstNodeStatementLoop>()->GetCode().get(), names);
+      return;
+    }
+    default: return;
+  }
+}
+
+using Environment = std::vector<std::pair<std::string, int64_t>>;
+
+// One environment per line, each a whitespace separated list of name=value
+std::optional<std::vector<Environment>> ReadEnvironments(const std::string& path) {
+  std::ifstream input(path);
+  if (!input) {
+    return std::nullopt;
+  }
+
+  std::vector<Environment> environments;
+  std::string line;
+  while (std::getline(input, line)) {
+    Environment& environment = environments.emplace_back();
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word) {
+      size_t separator = word.find('=');
+      if (separator == std::string::npos || separator == 0) {
+        return std::nullopt;
+      }
+
+      int64_t value = 0;
+      const char* end = word.data() + word.size();
+      auto [position, error] = std::from_chars(word.data() + separator + 1, end, value);
+      if (error != std::errc() || position != end) {
+        return std::nullopt;
+      }
+
+      environment.emplace_back(word.substr(0, separator), value);
+    }
+  }
+
+  return environments;
+}
+
+int RunBatch(AstNode* program, const std::vector<Environment>& environments) {
+  Resolver resolver;
+  resolver.Resolve(program);
+  // Environments may name variables the program never mentions
+  SymbolTable variables = resolver.GetVariables();
+  for (const auto& environment : environments) {
+    for (const auto& [name, value] : environment) {
+      variables.GetOrAdd(name);
+    }
+  }
+
+  BatchInterpreter interpreter(variables, resolver.GetFunctions(), environments.size());
+  for (size_t lane = 0; lane < environments.size(); ++lane) {
+    for (const auto& [name, value] : environments[lane]) {
+      interpreter.Define(lane, variables.Find(name), value);
+    }
+  }
+
+  interpreter.Evaluate(program);
+  int exitCode = 0;
+  OutputSink& output = OutputSink::Standard();
+  const auto& results = interpreter.GetResults();
+  for (size_t lane = 0; lane < results.size(); ++lane) {
+    output.Write("Environment ");
+    output.Write(std::to_string(lane));
+    output.Write(":\n");
+    output.Write(results[lane].output);
+    if (!results[lane].error.empty()) {
+      output.Write(results[lane].error);
+      output.Write("\nFail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n");
+      exitCode = 3;
+    }
+  }
+
+  output.Flush();
+  return exitCode;
+}
+
+struct VariantResult final {
+  std::string output;
+  std::string error;
+  int exitCode = 0;
+};
+
+// Every environment is a fork of base with its variables assigned, all forks run on the pool.
+// The program is only read, so they share it. The hooks are copied into every fork, so they have to
+// allow that (what-if runs aren't profiled or traced)
+template <typename Hooks>
+int RunWhatIf(BasicInterpreter<Hooks>& base, const AstNode* program, const SymbolTable& variables, const std::vector<Environment>& environments, size_t threadCount) {
+  std::vector<BasicInterpreter<Hooks>> forks;
+  forks.reserve(environments.size());
+  for (const auto& environment : environments) {
+    BasicInterpreter<Hooks>& fork = forks.emplace_back(base.Fork());
+    for (const auto& [name, value] : environment) {
+      fork.Define(variables.Find(name), value);
+    }
+  }
+
+  std::vector<VariantResult> results(environments.size());
+  {
+    ThreadPool pool(std::min(threadCount, forks.size()));
+    for (size_t i = 0; i < forks.size(); ++i) {
+      pool.Submit([&fork = forks[i], &result = results[i], program] {
+        OutputSink output = OutputSink::ToString(result.output);
+        fork.SetOutput(output);
+        try {
+          fork.Evaluate(program);
+        } catch (ExecutionException& e) {
+          result.error = std::string(e.what()) + "\nFail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n";
+          result.exitCode = 3;
+        } catch (LimitExceededException& e) {
+          result.error = std::string(e.what()) + '\n';
+          result.exitCode = 5;
+        }
+      });
+    }
+
+    pool.Wait();
+  }
+
+  int exitCode = 0;
+  OutputSink& output = OutputSink::Standard();
+  for (size_t i = 0; i < results.size(); ++i) {
+    output.Write("Variant ");
+    output.Write(std::to_string(i));
+    output.Write(":\n");
+    output.Write(results[i].output);
+    output.Write(results[i].error);
+    if (exitCode == 0) {
+      exitCode = results[i].exitCode;
+    }
+  }
+
+  output.Flush();
+  return exitCode;
+}
+
+// Written even if the run failed, the profile is most interesting when it did
+bool WriteProfile(std::optional<Profiler>& profiler, const Options& options) {
+  if (!profiler) {
+    return true;
+  }
+
+  profiler->Stop();
+  if (!options.profilePath.empty()) {
+    std::ofstream output(options.profilePath);
+    profiler->WriteReport(output);
+    if (!output) {
+      std::cout << "Can't write " << options.profilePath << '\n';
+      return false;
+    }
+  }
+
+  if (!options.foldedStacksPath.empty()) {
+    std::ofstream output(options.foldedStacksPath);
+    profiler->WriteFoldedStacks(output);
+    if (!output) {
+      std::cout << "Can't write " << options.foldedStacksPath << '\n';
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Like the profile, the trace of a failed run is the one worth reading
+bool WriteTrace(const std::optional<Tracer>& tracer, const Options& options) {
+  if (tracer && !tracer->Write(options.tracePath)) {
+    std::cout << "Can't write " << options.tracePath << '\n';
+    return false;
+  }
+
+  return true;
+}
+
+// Lexing, parsing, optimizing and the run, written when main returns whichever way it does
+struct PhaseCounters final {
+  explicit PhaseCounters(const Options& options)
+  : m_options(options) {
+    if (options.perfCountersPath.empty() && options.perfCountersJsonPath.empty()) {
+      return;
+    }
+
+    m_counters.emplace();
+    if (!m_counters->IsAvailable()) {
+      std::cerr << "Hardware counters are unavailable (" << m_counters->GetError() << "), timing phases only\n";
+    }
+  }
+
+  PhaseCounters(const PhaseCounters&) = delete;
+  PhaseCounters& operator=(const PhaseCounters&) = delete;
+
+  ~PhaseCounters() {
+    if (!m_counters) {
+      return;
+    }
+
+    m_counters->End();
+    if (!m_options.perfCountersPath.empty()) {
+      std::ofstream output(m_options.perfCountersPath);
+      m_counters->WriteReport(output);
+      if (!output) {
+        std::cout << "Can't write " << m_options.perfCountersPath << '\n';
+      }
+    }
+
+    if (!m_options.perfCountersJsonPath.empty()) {
+      std::ofstream output(m_options.perfCountersJsonPath);
+      m_counters->WriteJson(output);
+      if (!output) {
+        std::cout << "Can't write " << m_options.perfCountersJsonPath << '\n';
+      }
+    }
+  }
+
+  void Begin(const char* phase) {
+    if (m_counters) {
+      m_counters->Begin(phase);
+    }
+  }
+
+  void End() {
+    if (m_counters) {
+      m_counters->End();
+    }
+  }
+
+private:
+  const Options& m_options;
+  std::optional<PerfCounters> m_counters;
+};
+
 void PrintToken(const Token* token) {
   TokenType type = token->GetType();
   switch (type) {
@@ -96,10 +532,15 @@ void PrintTokens(const std::vector<std::unique_ptr<Token>>& tokens) {
   }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+  Options options = ParseOptions(argc, argv);
   std::string input = GetInput();
+  PhaseCounters phases(options);
+  phases.Begin("lex");
   Lexer lexer(input);
-  if (!lexer.Tokenize()) {
+  bool isTokenized = lexer.Tokenize();
+  phases.End();
+  if (!isTokenized) {
     std::cout << "Fail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n";
     return 1;
   }
@@ -107,23 +548,245 @@ int main() {
   std::cout << "Success UwU\n\n";
   const auto& tokens = lexer.GetTokens();
   PrintTokens(tokens);
-  std::cout.flush();
+  // Backends print through OutputSink, straight to the fd
   std::cout << '\n';
+  std::cout.flush();
 
+  phases.Begin("parse");
   Parser parser(tokens);
   auto program = parser.Parse();
+  phases.End();
   if (!program) {
     std::cout << "Fail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n";
     return 2;
   }
 
-  Interpreter interpreter;
+  bool hasSnapshot = !options.loadSnapshotPath.empty() || !options.saveSnapshotPath.empty();
+  if (hasSnapshot && (options.useVirtualMachine || options.sliceSteps > 0 || !options.batchPath.empty() || !options.emitCppPath.empty())) {
+    std::cout << "Snapshots are only supported by the tree interpreter\n";
+    return 4;
+  }
+
+  if (!options.loadSnapshotPath.empty() && !options.saveSnapshotPath.empty()) {
+    std::cout << "Can't save a snapshot of a run that started from one\n";
+    return 4;
+  }
+
+  bool isWhatIf = !options.whatIfPath.empty();
+  if (isWhatIf && (options.useVirtualMachine || options.sliceSteps > 0 || !options.batchPath.empty() || !options.emitCppPath.empty())) {
+    std::cout << "What-if runs are only supported by the tree interpreter\n";
+    return 4;
+  }
+
+  if (isWhatIf && !options.saveSnapshotPath.empty()) {
+    std::cout << "Can't save a snapshot of many variants\n";
+    return 4;
+  }
+
+  // The state after the snapshot's program ran, that program is parsed again for the function bodies
+  std::unique_ptr<SnapshotFile> snapshot;
+  std::shared_ptr<AstNode> prologue;
+  if (!options.loadSnapshotPath.empty()) {
+    snapshot = SnapshotFile::Open(options.loadSnapshotPath);
+    prologue = snapshot ? ParseProgram(snapshot->GetSource()) : nullptr;
+    if (!prologue) {
+      std::cout << "Can't read " << options.loadSnapshotPath << '\n';
+      return 4;
+    }
+  }
+
+  // The tree interpreter optimizes function bodies on their first call, everything else takes the whole program
+  bool isTreeInterpreter = !options.useVirtualMachine && options.sliceSteps == 0 && options.batchPath.empty() && options.emitCppPath.empty();
+  std::optional<Optimizer> optimizer;
+  if (options.optimize) {
+    OptimizerOptions optimizerOptions;
+    optimizerOptions.hasInitialVariables = !options.batchPath.empty() || isWhatIf || snapshot;
+    optimizerOptions.keepFinalState = !options.saveSnapshotPath.empty();
+    optimizerOptions.deferFunctionBodies = isTreeInterpreter;
+    // The prologue isn't optimized on its own, it can't know what the program binds its calls to.
+    // Restored bodies are optimized on their first call like the program's own, and as they may
+    // declare anything the prologue declares, all of that is out of the optimizer's reach
+    if (prologue) {
+      CollectFunctionNames(prologue.get(), optimizerOptions.initialFunctions);
+    }
+
+    phases.Begin("optimize");
+    optimizer.emplace(optimizerOptions);
+    program = optimizer->Optimize(program);
+    phases.End();
+    std::cerr << "Optimizer eliminated " << optimizer->GetEliminatedCount() << " statements\n";
+  }
+
+  if (!options.emitCppPath.empty()) {
+    std::ofstream output(options.emitCppPath);
+    output << CppTranspiler().Transpile(program.get());
+    if (!output) {
+      std::cout << "Can't write " << options.emitCppPath << '\n';
+      return 4;
+    }
+
+    return 0;
+  }
+
+  bool isProfiling = !options.profilePath.empty() || !options.foldedStacksPath.empty();
+  if (isProfiling && (options.useVirtualMachine || options.sliceSteps > 0 || !options.batchPath.empty() || isWhatIf)) {
+    std::cerr << "Profiling is only supported by the tree interpreter, running without it\n";
+    isProfiling = false;
+  }
+
+  bool isTracing = !options.tracePath.empty();
+  if (isTracing && (options.useVirtualMachine || options.sliceSteps > 0 || !options.batchPath.empty() || isWhatIf)) {
+    std::cerr << "Tracing is only supported by the tree interpreter, running without it\n";
+    isTracing = false;
+  }
+
+  phases.Begin("run");
   try {
-    interpreter.Evaluate(program.get());
+    if (!options.batchPath.empty()) {
+      auto environments = ReadEnvironments(options.batchPath);
+      if (!environments) {
+        std::cout << "Can't read " << options.batchPath << '\n';
+        return 4;
+      }
+
+      return RunBatch(program.get(), *environments);
+    }
+
+    if (options.sliceSteps > 0) {
+      Scheduler scheduler(SchedulerOptions(options.sliceSteps, options.interpreter));
+      Scheduler::TaskId task = scheduler.Add(program);
+      scheduler.RunAll();
+      TaskProgress progress = scheduler.GetProgress(task);
+      if (progress.state == TaskState::FAILED) {
+        throw ExecutionException(progress.error.c_str());
+      }
+
+      if (progress.state == TaskState::LIMIT_EXCEEDED) {
+        throw LimitExceededException(progress.error.c_str());
+      }
+
+      return 0;
+    }
+
+    if (options.useVirtualMachine) {
+      CompilerOptions compilerOptions;
+      compilerOptions.inlineFunctions = options.inlineFunctions;
+      BytecodeProgram bytecode = Compiler(compilerOptions).Compile(program.get());
+      VirtualMachine machine(bytecode);
+      if (options.useJit && !machine.EnableJit()) {
+        std::cerr << "JIT is not supported on this platform, running the bytecode VM\n";
+      }
+
+      machine.Run();
+    } else {
+      Resolver resolver;
+      if (prologue) {
+        resolver.Resolve(prologue.get());
+      }
+
+      resolver.Resolve(program.get());
+      // The snapshot and the variants may hold variables neither program mentions any more
+      SymbolTable variables = resolver.GetVariables();
+      for (size_t i = 0; snapshot && i < snapshot->GetVariableCount(); ++i) {
+        const SnapshotVariable& variable = snapshot->GetVariables()[i];
+        variables.GetOrAdd(std::string(snapshot->GetName(variable.nameOffset, variable.nameSize)));
+      }
+
+      std::optional<std::vector<Environment>> variants;
+      if (isWhatIf) {
+        variants = ReadEnvironments(options.whatIfPath);
+        if (!variants) {
+          std::cout << "Can't read " << options.whatIfPath << '\n';
+          return 4;
+        }
+
+        for (const auto& variant : *variants) {
+          for (const auto& [name, value] : variant) {
+            variables.GetOrAdd(name);
+          }
+        }
+      }
+
+      std::optional<FunctionCompiler> functionCompiler;
+      if (optimizer) {
+        functionCompiler.emplace(std::move(*optimizer), resolver);
+      }
+
+      std::optional<Profiler> profiler;
+      if (isProfiling) {
+        profiler.emplace(resolver.GetFunctions());
+      }
+
+      std::optional<Tracer> tracer;
+      if (isTracing) {
+        tracer.emplace(variables, resolver.GetFunctions());
+      }
+
+      // Profiling and tracing are hooks, every combination is an interpreter of its own
+      auto run = [&](auto interpreter) {
+        if (functionCompiler) {
+          interpreter.SetFunctionCompiler(&*functionCompiler);
+        }
+
+        if (options.useNativeTier && !interpreter.EnableNativeTier()) {
+          std::cerr << "Native tier is not supported with these options, running the tree interpreter only\n";
+        }
+
+        if (snapshot && !interpreter.Restore(*snapshot, prologue.get())) {
+          std::cout << "Can't restore " << options.loadSnapshotPath << '\n';
+          return 4;
+        }
+
+        if (variants) {
+          return RunWhatIf(interpreter, program.get(), variables, *variants, options.threadCount);
+        }
+
+        try {
+          interpreter.Evaluate(program.get());
+        } catch (...) {
+          WriteProfile(profiler, options);
+          WriteTrace(tracer, options);
+          throw;
+        }
+
+        if (!WriteProfile(profiler, options) || !WriteTrace(tracer, options)) {
+          return 4;
+        }
+
+        if (!options.saveSnapshotPath.empty()) {
+          SnapshotWriter writer(input);
+          interpreter.Save(writer);
+          if (!writer.Write(options.saveSnapshotPath)) {
+            std::cout << "Can't write " << options.saveSnapshotPath << '\n';
+            return 4;
+          }
+        }
+
+        return 0;
+      };
+
+      const SymbolTable& functions = resolver.GetFunctions();
+      if (profiler && tracer) {
+        return run(BasicInterpreter(variables, functions, options.interpreter, CombinedHooks(ProfilerHooks(&*profiler), TracerHooks(&*tracer))));
+      }
+
+      if (profiler) {
+        return run(BasicInterpreter(variables, functions, options.interpreter, ProfilerHooks(&*profiler)));
+      }
+
+      if (tracer) {
+        return run(BasicInterpreter(variables, functions, options.interpreter, TracerHooks(&*tracer)));
+      }
+
+      return run(Interpreter(variables, functions, options.interpreter));
+    }
   } catch (ExecutionException& e) {
     std::cout << e.what() << '\n';
     std::cout << "Fail! FAIL!!1 YOU ARE A FAILURE !!1!!1!\n";
     return 3;
+  } catch (LimitExceededException& e) {
+    std::cout << e.what() << '\n';
+    return 5;
   }
 
   return 0;
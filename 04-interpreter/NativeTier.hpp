@@ -0,0 +1,183 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "Bytecode.hpp"
+#include "Compiler.hpp"
+#include "Jit.hpp"
+#include "PersistentVariableStorage.hpp"
+#include "SymbolTable.hpp"
+#include "VariableStorage.hpp"
+
+/*
+
+Native tier of the tree interpreter
+
+Every run starts in the tree. The Interpreter counts how hot its loops (by iterations) and function
+bodies (by calls) are, and once one crosses its JitOptions threshold it's compiled on its own, to
+bytecode and from there to native code:
+
+  loop - switches at a back-edge, the iterations left run natively
+  function body - switches on a call
+
+Short runs never pay for compiling, long ones spend their time in native code.
+
+The Jit takes only arithmetic and branches, so anything that can print, call, delete or declare
+stays in the tree for good, and so does code whose variables aren't all defined yet. The latter
+is tried again after another threshold's worth of heat. Native code works on a flat copy of the
+slots it touches, copied in before and back after.
+
+*/
+
+// A loop or a function body compiled on its own, with its slots mapped to the Interpreter's
+struct NativeFragment final {
+  explicit NativeFragment(BytecodeProgram compiled)
+  : program(std::move(compiled))
+  , jit(program, JitOptions(0, 0))
+  , values()
+  , functions(program.functions.GetSize(), kUnboundFunction) {
+    values.Resize(program.variables.GetSize());
+  }
+
+  // The Jit refers to it, so a fragment never moves
+  BytecodeProgram program;
+  Jit jit;
+  // Fragment slot -> Interpreter slot, SymbolTable::kInvalidSlot for the loop counter
+  std::vector<uint32_t> variableSlots;
+  std::vector<uint32_t> functionSlots;
+  uint32_t counterSlot = SymbolTable::kInvalidSlot;
+  // What the native code sees
+  VariableStorage values;
+  std::vector<uint32_t> functions;
+};
+
+struct NativeTier final {
+  // Heat of a loop or a function body, found once per loop run or call
+  struct Site final {
+    uint64_t hotness = 0;
+    bool isUnsupported = false;
+    // Null until it's hot
+    std::unique_ptr<NativeFragment> fragment;
+  };
+
+  NativeTier(std::shared_ptr<const SymbolTable> variables, std::shared_ptr<const SymbolTable> functions, JitOptions options = {})
+  : m_variableNames(std::move(variables))
+  , m_functionNames(std::move(functions))
+  , m_options(options) {
+  }
+
+  NativeTier(const NativeTier&) = delete;
+  NativeTier& operator=(const NativeTier&) = delete;
+
+  Site& GetSite(const AstNode* node) {
+    return m_sites[node];
+  }
+
+  // At a back-edge with remaining iterations left. True if they have run natively
+  bool TryRunLoop(Site& site, const AstNodeStatementLoop* loop, int64_t remaining, PersistentVariableStorage& variables, const std::vector<const AstNodeStatementChain*>& bodies) {
+    if (site.isUnsupported || ++site.hotness < m_options.hotLoopIterations) {
+      return false;
+    }
+
+    if (!site.fragment) {
+      site.fragment = MakeFragment(Compiler().CompileLoopRemainder(loop));
+    }
+
+    return Run(site, remaining, variables, bodies);
+  }
+
+  // On a call, before the body runs. True if it has run natively
+  bool TryRunFunction(const AstNodeStatementChain* body, PersistentVariableStorage& variables, const std::vector<const AstNodeStatementChain*>& bodies) {
+    Site& site = m_sites[body];
+    if (site.isUnsupported || ++site.hotness < m_options.hotFunctionCalls) {
+      return false;
+    }
+
+    if (!site.fragment) {
+      site.fragment = MakeFragment(Compiler().CompileFunctionBody(body));
+    }
+
+    return Run(site, 0, variables, bodies);
+  }
+
+  [[nodiscard]] const JitOptions& GetOptions() const {
+    return m_options;
+  }
+
+  // Loops and function bodies running natively
+  [[nodiscard]] size_t GetCompiledCount() const {
+    size_t count = 0;
+    for (const auto& [node, site] : m_sites) {
+      count += site.fragment && site.fragment->jit.GetCompiledRegionCount() > 0;
+    }
+
+    return count;
+  }
+
+private:
+  std::unique_ptr<NativeFragment> MakeFragment(BytecodeProgram program) const {
+    auto fragment = std::make_unique<NativeFragment>(std::move(program));
+    const SymbolTable& variables = fragment->program.variables;
+    for (uint32_t slot = 0; slot < variables.GetSize(); ++slot) {
+      fragment->variableSlots.emplace_back(m_variableNames->Find(variables.GetName(slot)));
+    }
+
+    fragment->counterSlot = variables.Find(Compiler::kLoopCounterName);
+    const SymbolTable& functions = fragment->program.functions;
+    for (uint32_t slot = 0; slot < functions.GetSize(); ++slot) {
+      fragment->functionSlots.emplace_back(m_functionNames->Find(functions.GetName(slot)));
+    }
+
+    return fragment;
+  }
+
+  bool Run(Site& site, int64_t remaining, PersistentVariableStorage& variables, const std::vector<const AstNodeStatementChain*>& bodies) {
+    NativeFragment& fragment = *site.fragment;
+    fragment.values.Clear();
+    for (uint32_t slot = 0; slot < fragment.variableSlots.size(); ++slot) {
+      uint32_t source = fragment.variableSlots[slot];
+      if (source != SymbolTable::kInvalidSlot && variables.IsDefined(source)) {
+        fragment.values.Set(slot, variables.Get(source));
+      }
+    }
+
+    for (uint32_t slot = 0; slot < fragment.functionSlots.size(); ++slot) {
+      uint32_t source = fragment.functionSlots[slot];
+      fragment.functions[slot] = source != SymbolTable::kInvalidSlot && bodies[source] ? 0 : kUnboundFunction;
+    }
+
+    bool isRun = false;
+    if (fragment.counterSlot != SymbolTable::kInvalidSlot) {
+      fragment.values.Set(fragment.counterSlot, remaining);
+      isRun = fragment.jit.TryExecuteLoop(0, remaining, fragment.values, fragment.functions);
+    } else {
+      isRun = fragment.jit.TryExecuteFunction(0, fragment.values, fragment.functions);
+    }
+
+    if (!isRun) {
+      // Either the Jit can't take it at all or something isn't defined yet, which may change
+      site.isUnsupported = fragment.jit.GetCompiledRegionCount() == 0;
+      site.hotness = 0;
+      return false;
+    }
+
+    // Nothing was declared natively, so what's defined there is defined here. Unchanged values are
+    // skipped, writing them would copy chunks a fork still shares
+    fragment.values.ForEach([&fragment, &variables](uint32_t slot, int64_t value) {
+      uint32_t target = fragment.variableSlots[slot];
+      if (target != SymbolTable::kInvalidSlot && variables.Get(target) != value) {
+        variables.At(target) = value;
+      }
+    });
+    return true;
+  }
+
+private:
+  std::shared_ptr<const SymbolTable> m_variableNames;
+  std::shared_ptr<const SymbolTable> m_functionNames;
+  JitOptions m_options;
+  std::unordered_map<const AstNode*, Site> m_sites;
+};
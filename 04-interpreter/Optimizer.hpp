@@ -0,0 +1,1285 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Arithmetic.hpp"
+#include "AstNodes.hpp"
+
+struct OptimizerOptions final {
+  // Calls inside loops to small leaf functions with a single declaration are replaced by the body
+  bool inlineCalls = true;
+  uint32_t maxInlineStatements = 16;
+  // Conditions on constants and known variables are folded, dead blocks and statements after print removed
+  bool foldConstants = true;
+  // Modifications nothing can observe are removed
+  bool eliminateDeadStores = true;
+  // Loops are split on conditions that are the same in every iteration
+  bool unswitchLoops = true;
+  uint32_t maxUnswitchDepth = 2;
+  uint32_t maxUnswitchStatements = 32;
+  // Loops made only of add/sub/mult/= become AstNodeStatementAffineLoop
+  bool closedFormLoops = true;
+  // Runs of modifications become one AstNodeStatementAffineModification per variable
+  bool fuseModifications = true;
+  // Variables may already be defined when the program starts, e.g. by a batch environment
+  bool hasInitialVariables = false;
+  // Functions already declared when the program starts, e.g. by a snapshot. Calls to them may do anything
+  std::unordered_set<std::string> initialFunctions;
+  // Variables are still observed once the program ends, e.g. saved to a snapshot
+  bool keepFinalState = false;
+  // Function bodies are left as they are, for OptimizeFunctionBody on their first call
+  bool deferFunctionBodies = false;
+};
+
+// AST -> equivalent AST, runs before Resolver. Output, errors and print order stay the same
+struct Optimizer final {
+  explicit Optimizer(OptimizerOptions options = {})
+  : m_options(options) {
+  }
+
+  std::shared_ptr<AstNode> Optimize(const std::shared_ptr<AstNode>& root) {
+    // Every pass may change function bodies, summaries are taken again after each of them
+    std::shared_ptr<AstNode> result = root;
+    Definedness initial = m_options.hasInitialVariables ? Definedness::Unknown() : Definedness();
+    SummarizeFunctions(result.get());
+    if (m_options.inlineCalls) {
+      result = InlineCalls(result, false);
+      SummarizeFunctions(result.get());
+    }
+
+    if (m_options.foldConstants) {
+      Constants constants;
+      std::vector<std::shared_ptr<AstNode>> statements;
+      FoldStatement(result, constants, statements);
+      result = std::make_shared<AstNodeStatementChain>(std::move(statements));
+      SummarizeFunctions(result.get());
+    }
+
+    if (m_options.eliminateDeadStores) {
+      result = EliminateDeadStores(result, initial, !m_options.keepFinalState);
+      SummarizeFunctions(result.get());
+    }
+
+    if (m_options.unswitchLoops) {
+      result = UnswitchLoops(result, initial);
+    }
+
+    return Rewrite(result);
+  }
+
+  // A body Optimize left alone with deferFunctionBodies, optimized the way Optimize would have.
+  // Summaries of the whole program are still those Optimize took, so the same Optimizer has to do it
+  std::shared_ptr<AstNode> OptimizeFunctionBody(const std::shared_ptr<AstNode>& code) {
+    std::shared_ptr<AstNode> result = code;
+    if (m_options.inlineCalls) {
+      result = InlineCalls(result, false);
+    }
+
+    if (m_options.foldConstants) {
+      Constants constants;
+      result = FoldBlock(result, constants);
+    }
+
+    if (m_options.eliminateDeadStores) {
+      result = EliminateDeadStores(result, Definedness::Unknown(), false);
+    }
+
+    if (m_options.unswitchLoops) {
+      result = UnswitchLoops(result, Definedness::Unknown());
+    }
+
+    return Rewrite(result);
+  }
+
+  // Statements removed by any of the passes
+  [[nodiscard]] size_t GetEliminatedCount() const {
+    return m_eliminatedCount;
+  }
+
+private:
+  std::shared_ptr<AstNode> Rewrite(const std::shared_ptr<AstNode>& node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        std::vector<std::shared_ptr<AstNode>> statements;
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          statements.emplace_back(Rewrite(statement));
+        }
+
+        if (m_options.fuseModifications) {
+          statements = FuseModifications(statements);
+        }
+
+        return std::make_shared<AstNodeStatementChain>(std::move(statements));
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        if (m_options.deferFunctionBodies) {
+          return node;
+        }
+
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        return At(node.get(), std::make_shared<AstNodeStatementFunctionDeclaration>(declaration->GetFunctionName(), Rewrite(declaration->GetCode())));
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        return At(node.get(), std::make_shared<AstNodeStatementCondition>(condition->GetCondition(), Rewrite(condition->GetCode())));
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        // Checked before the body is optimized, fused modifications are no longer plain add/sub/mult/=
+        auto loop = std::static_pointer_cast<AstNodeStatementLoop>(node);
+        if (m_options.closedFormLoops) {
+          if (auto affineLoop = TryMakeAffineLoop(loop)) {
+            return At(node.get(), std::move(affineLoop));
+          }
+        }
+
+        return At(node.get(), std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), Rewrite(loop->GetCode())));
+      }
+      default: return node;
+    }
+  }
+
+  // Rebuilt statements keep the position of the one they replace, for the profiler
+  template <typename T>
+  static std::shared_ptr<T> At(const AstNode* original, std::shared_ptr<T> node) {
+    node->SetSourcePosition(original->GetSourcePosition());
+    return node;
+  }
+
+  static size_t CountStatements(const AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        size_t count = 0;
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          count += CountStatements(statement.get());
+        }
+
+        return count;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        return 1 + CountStatements(node->As<AstNodeStatementFunctionDeclaration>()->GetCode().get());
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        return 1 + CountStatements(node->As<AstNodeStatementCondition>()->GetCode().get());
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        return 1 + CountStatements(node->As<AstNodeStatementLoop>()->GetCode().get());
+      }
+      default: return 1;
+    }
+  }
+
+  /*
+
+  Constant folding
+
+  Walks statements in execution order and tracks variables whose value is a known constant
+  (which also means they are defined, so reading them can't fail). Their reads are replaced
+  with numbers and conditions that end up constant are decided at compile time.
+  A condition is only dropped where the original wouldn't have evaluated it or where
+  it can't fail, so errors stay the same.
+
+  Calls forget whatever their function summary may modify, blocks that may or may not run
+  forget whatever they modify.
+
+  */
+
+  using Constants = std::unordered_map<std::string, int64_t>;
+
+  static std::shared_ptr<AstNode> FoldValue(const std::shared_ptr<AstNode>& node, const Constants& constants) {
+    if (node->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      if (auto iter = constants.find(node->As<AstNodeValueIdentifier>()->GetName()); iter != constants.end()) {
+        return std::make_shared<AstNodeValueNumber>(iter->second);
+      }
+    }
+
+    return node;
+  }
+
+  static std::optional<int64_t> GetConstant(const AstNode* node) {
+    if (node->GetType() == AstNodeType::VALUE_NUMBER) {
+      return node->As<AstNodeValueNumber>()->GetValue();
+    }
+
+    return std::nullopt;
+  }
+
+  struct FoldedCondition final {
+    // Set if the value isn't known
+    std::shared_ptr<AstNode> node;
+    std::optional<bool> value;
+  };
+
+  static FoldedCondition FoldCondition(const std::shared_ptr<AstNode>& node, const Constants& constants) {
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    if (!opNode) {
+      return FoldedCondition(node, std::nullopt);
+    }
+
+    BinaryOperatorType opType = opNode->GetOperatorType();
+    switch (opType) {
+      case BinaryOperatorType::EQUALS:
+      case BinaryOperatorType::NOT_EQUALS: {
+        auto left = FoldValue(opNode->GetLeft(), constants);
+        auto right = FoldValue(opNode->GetRight(), constants);
+        auto leftValue = GetConstant(left.get());
+        auto rightValue = GetConstant(right.get());
+        if (leftValue && rightValue) {
+          return FoldedCondition(nullptr, (*leftValue == *rightValue) == (opType == BinaryOperatorType::EQUALS));
+        }
+
+        return FoldedCondition(std::make_shared<AstNodeBinaryOperator>(opType, std::move(left), std::move(right)), std::nullopt);
+      }
+      case BinaryOperatorType::OR:
+      case BinaryOperatorType::AND: {
+        // true for or, false for and
+        bool shortCircuit = opType == BinaryOperatorType::OR;
+        FoldedCondition left = FoldCondition(opNode->GetLeft(), constants);
+        if (left.value) {
+          return *left.value == shortCircuit ? left : FoldCondition(opNode->GetRight(), constants);
+        }
+
+        // The left side still has to be evaluated, it may fail
+        FoldedCondition right = FoldCondition(opNode->GetRight(), constants);
+        if (right.value && *right.value != shortCircuit) {
+          return left;
+        }
+
+        return FoldedCondition(std::make_shared<AstNodeBinaryOperator>(opType, left.node, right.value ? opNode->GetRight() : right.node), std::nullopt);
+      }
+      default: return FoldedCondition(node, std::nullopt);
+    }
+  }
+
+  // Forgets every variable the subtree may modify
+  void Invalidate(const AstNode* node, Constants& constants) const {
+    Effects effects;
+    CollectEffects(node, effects);
+    if (effects.mayDoAnything) {
+      constants.clear();
+      return;
+    }
+
+    for (const auto& name : effects.written) {
+      constants.erase(name);
+    }
+  }
+
+  std::shared_ptr<AstNode> FoldBlock(const std::shared_ptr<AstNode>& node, Constants& constants) {
+    std::vector<std::shared_ptr<AstNode>> statements;
+    FoldStatement(node, constants, statements);
+    return std::make_shared<AstNodeStatementChain>(std::move(statements));
+  }
+
+  // Appends the folded statement to result. Returns true if it always prints, nothing after it can run then
+  bool FoldStatement(const std::shared_ptr<AstNode>& node, Constants& constants, std::vector<std::shared_ptr<AstNode>>& result) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        const auto& statements = node->As<AstNodeStatementChain>()->GetStatements();
+        for (auto iter = statements.begin(); iter != statements.end(); ++iter) {
+          if (FoldStatement(*iter, constants, result)) {
+            for (++iter; iter != statements.end(); ++iter) {
+              m_eliminatedCount += CountStatements(iter->get());
+            }
+
+            return true;
+          }
+        }
+
+        return false;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        result.emplace_back(node);
+        return true;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        constants.erase(node->As<AstNodeStatementDelete>()->GetVariableName());
+        result.emplace_back(node);
+        return false;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        Invalidate(node.get(), constants);
+        result.emplace_back(node);
+        return false;
+      }
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        result.emplace_back(node);
+        return false;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        const auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+        const auto& name = modification->GetVariableName();
+        auto value = FoldValue(modification->GetValue(), constants);
+        auto constant = GetConstant(value.get());
+        auto known = constants.find(name);
+        ModificationOperatorType opType = modification->GetOperatorType();
+        if (constant && opType == ModificationOperatorType::ASSIGN) {
+          constants[name] = *constant;
+        } else if (constant && known != constants.end() && opType == ModificationOperatorType::ADD) {
+          known->second = WrappingAdd(known->second, *constant);
+        } else if (constant && known != constants.end() && opType == ModificationOperatorType::SUBTRACT) {
+          known->second = WrappingSubtract(known->second, *constant);
+        } else if (constant && known != constants.end() && opType == ModificationOperatorType::MULTIPLY) {
+          known->second = WrappingMultiply(known->second, *constant);
+        } else {
+          constants.erase(name);
+        }
+
+        result.emplace_back(value == modification->GetValue()
+        ? node
+        : At(node.get(), std::make_shared<AstNodeBinaryStatementVarModification>(opType, name, std::move(value))));
+        return false;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        if (m_options.deferFunctionBodies) {
+          result.emplace_back(node);
+          return false;
+        }
+
+        // Bodies run whenever they are called, nothing is known there
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        Constants bodyConstants;
+        result.emplace_back(At(node.get(), std::make_shared<AstNodeStatementFunctionDeclaration>(
+          declaration->GetFunctionName(), FoldBlock(declaration->GetCode(), bodyConstants))));
+        return false;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        FoldedCondition folded = FoldCondition(condition->GetCondition(), constants);
+        if (folded.value) {
+          if (!*folded.value) {
+            m_eliminatedCount += CountStatements(node.get());
+            return false;
+          }
+
+          // Always runs, the block becomes part of the enclosing chain
+          ++m_eliminatedCount;
+          return FoldStatement(condition->GetCode(), constants, result);
+        }
+
+        Constants blockConstants = constants;
+        auto code = FoldBlock(condition->GetCode(), blockConstants);
+        Invalidate(code.get(), constants);
+        result.emplace_back(At(node.get(), std::make_shared<AstNodeStatementCondition>(folded.node, std::move(code))));
+        return false;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        const auto* loop = node->As<AstNodeStatementLoop>();
+        auto count = FoldValue(loop->GetInitValue(), constants);
+        auto constant = GetConstant(count.get());
+        if (constant && *constant <= 0) {
+          m_eliminatedCount += CountStatements(node.get());
+          return false;
+        }
+
+        if (constant && *constant == 1) {
+          ++m_eliminatedCount;
+          return FoldStatement(loop->GetCode(), constants, result);
+        }
+
+        // Every iteration starts with whatever the body doesn't modify
+        Invalidate(loop->GetCode().get(), constants);
+        Constants bodyConstants = constants;
+        auto code = FoldBlock(loop->GetCode(), bodyConstants);
+        result.emplace_back(At(node.get(), std::make_shared<AstNodeStatementLoop>(std::move(count), std::move(code))));
+        return false;
+      }
+      default: {
+        constants.clear();
+        result.emplace_back(node);
+        return false;
+      }
+    }
+  }
+
+  static bool CollectModifications(const AstNode* node, std::vector<const AstNodeBinaryStatementVarModification*>& modifications) {
+    if (node->GetType() == AstNodeType::STATEMENT_CHAIN) {
+      for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+        if (!CollectModifications(statement.get(), modifications)) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    if (node->GetType() == AstNodeType::STATEMENT_VAR_MODIFICATION) {
+      modifications.emplace_back(node->As<AstNodeBinaryStatementVarModification>());
+      return true;
+    }
+
+    // Left by an inlined call, it can only fail the first time
+    return node->GetType() == AstNodeType::STATEMENT_CHECK_FUNCTION;
+  }
+
+  // The body is affine if every statement is a modification and nothing is multiplied by a variable
+  // the body itself modifies. Reads of other variables are loop invariants
+  static std::shared_ptr<AstNode> TryMakeAffineLoop(const std::shared_ptr<AstNodeStatementLoop>& loop) {
+    std::vector<const AstNodeBinaryStatementVarModification*> modifications;
+    if (!CollectModifications(loop->GetCode().get(), modifications)) {
+      return nullptr;
+    }
+
+    std::vector<std::string> variableNames;
+    for (const auto* modification : modifications) {
+      const auto& name = modification->GetVariableName();
+      if (std::find(variableNames.begin(), variableNames.end(), name) == variableNames.end()) {
+        variableNames.emplace_back(name);
+      }
+    }
+
+    for (const auto* modification : modifications) {
+      const AstNode* value = modification->GetValue().get();
+      if (modification->GetOperatorType() == ModificationOperatorType::MULTIPLY && value->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+        const auto& name = value->As<AstNodeValueIdentifier>()->GetName();
+        if (std::find(variableNames.begin(), variableNames.end(), name) != variableNames.end()) {
+          return nullptr;
+        }
+      }
+    }
+
+    return std::make_shared<AstNodeStatementAffineLoop>(loop, std::move(variableNames));
+  }
+
+  /*
+
+  Dead store elimination
+
+  A variable's value is observed only by reads, add/sub/mult on it and print, its definedness
+  also by delete. A modification is dropped when the next thing that happens to its variable in
+  the same chain is an assignment or a delete, or nothing at all because the program ends there.
+  The statement itself must not be able to fail, and it must not declare the variable unless
+  that declaration is unobservable too. A declaration that is deleted again before anything
+  looks at it is dropped together with the delete.
+
+  Definedness comes from a forward pass over the original statements. Calls assign, delete
+  and observe whatever their function summary says.
+
+  */
+
+  struct Definedness final {
+    std::unordered_set<std::string> defined;
+    std::unordered_set<std::string> maybeDefined;
+    // Nothing is known on entry, e.g. in a function body
+    bool isAnythingDefined = false;
+
+    static Definedness Unknown() {
+      Definedness definedness;
+      definedness.isAnythingDefined = true;
+      return definedness;
+    }
+
+    [[nodiscard]] bool IsDefined(const std::string& name) const {
+      return defined.contains(name);
+    }
+
+    [[nodiscard]] bool IsUndefined(const std::string& name) const {
+      return !isAnythingDefined && !maybeDefined.contains(name);
+    }
+  };
+
+  // Definedness after the statement
+  void UpdateDefinedness(const AstNode* statement, Definedness& definedness) const {
+    switch (statement->GetType()) {
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        const auto* modification = statement->As<AstNodeBinaryStatementVarModification>();
+        const AstNode* value = modification->GetValue().get();
+        if (value->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+          definedness.defined.emplace(value->As<AstNodeValueIdentifier>()->GetName());
+        }
+
+        definedness.defined.emplace(modification->GetVariableName());
+        definedness.maybeDefined.emplace(modification->GetVariableName());
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        const auto& name = statement->As<AstNodeStatementDelete>()->GetVariableName();
+        definedness.defined.erase(name);
+        definedness.maybeDefined.erase(name);
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        Effects effects;
+        CollectEffects(statement, effects);
+        ApplyEffects(effects, definedness);
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        Effects effects;
+        CollectEffects(statement->As<AstNodeStatementCondition>()->GetCode().get(), effects);
+        ApplyEffects(effects, definedness);
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        // Holds at the start of every iteration and after the last one
+        EnterLoop(statement->As<AstNodeStatementLoop>(), definedness);
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT:
+      case AstNodeType::STATEMENT_FUNC_DECL:
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        return;
+      }
+      default: {
+        definedness = Definedness::Unknown();
+        return;
+      }
+    }
+  }
+
+  void EnterLoop(const AstNodeStatementLoop* loop, Definedness& definedness) const {
+    const AstNode* count = loop->GetInitValue().get();
+    if (count->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      definedness.defined.emplace(count->As<AstNodeValueIdentifier>()->GetName());
+    }
+
+    Effects effects;
+    CollectEffects(loop->GetCode().get(), effects);
+    ApplyEffects(effects, definedness);
+  }
+
+  struct Effects final {
+    std::unordered_set<std::string> assigned;
+    std::unordered_set<std::string> deleted;
+    // Assigned, modified or deleted
+    std::unordered_set<std::string> written;
+    // Read, written or deleted
+    std::unordered_set<std::string> mentioned;
+    // Functions called directly or through other functions
+    std::unordered_set<std::string> callees;
+    // Nodes the analysis doesn't know
+    bool mayDoAnything = false;
+    bool hasPrint = false;
+  };
+
+  // Function bodies aren't entered, declaring a function doesn't run it
+  void CollectEffects(const AstNode* node, Effects& effects) const {
+    switch (node->GetType()) {
+      case AstNodeType::VALUE_IDENTIFIER: {
+        effects.mentioned.emplace(node->As<AstNodeValueIdentifier>()->GetName());
+        return;
+      }
+      case AstNodeType::BINARY_OPERATOR: {
+        const auto* opNode = node->As<AstNodeBinaryOperator>();
+        CollectEffects(opNode->GetLeft().get(), effects);
+        CollectEffects(opNode->GetRight().get(), effects);
+        return;
+      }
+      case AstNodeType::STATEMENT_CHAIN: {
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          CollectEffects(statement.get(), effects);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        effects.hasPrint = true;
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        // A name that is never declared can only fail
+        const auto& name = node->As<AstNodeStatementCall>()->GetFunctionName();
+        effects.callees.emplace(name);
+        if (auto iter = m_summaries.find(name); iter != m_summaries.end()) {
+          MergeEffects(iter->second.effects, effects);
+        } else if (m_options.initialFunctions.contains(name)) {
+          effects.mayDoAnything = true;
+          effects.hasPrint = true;
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        const auto& name = node->As<AstNodeStatementDelete>()->GetVariableName();
+        effects.deleted.emplace(name);
+        effects.written.emplace(name);
+        effects.mentioned.emplace(name);
+        return;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        const auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+        if (modification->GetOperatorType() == ModificationOperatorType::ASSIGN) {
+          effects.assigned.emplace(modification->GetVariableName());
+        }
+
+        effects.written.emplace(modification->GetVariableName());
+        effects.mentioned.emplace(modification->GetVariableName());
+        CollectEffects(modification->GetValue().get(), effects);
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        CollectEffects(condition->GetCondition().get(), effects);
+        CollectEffects(condition->GetCode().get(), effects);
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        const auto* loop = node->As<AstNodeStatementLoop>();
+        CollectEffects(loop->GetInitValue().get(), effects);
+        CollectEffects(loop->GetCode().get(), effects);
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL:
+      case AstNodeType::STATEMENT_CHECK_FUNCTION:
+      case AstNodeType::VALUE_NUMBER: {
+        return;
+      }
+      default: {
+        effects.mayDoAnything = true;
+        effects.hasPrint = true;
+        return;
+      }
+    }
+  }
+
+  // Returns true if anything was added
+  static bool MergeEffects(const Effects& from, Effects& into) {
+    auto getSize = [](const Effects& effects) {
+      return effects.assigned.size() + effects.deleted.size() + effects.written.size()
+      + effects.mentioned.size() + effects.callees.size() + effects.mayDoAnything + effects.hasPrint;
+    };
+
+    size_t size = getSize(into);
+    into.assigned.insert(from.assigned.begin(), from.assigned.end());
+    into.deleted.insert(from.deleted.begin(), from.deleted.end());
+    into.written.insert(from.written.begin(), from.written.end());
+    into.mentioned.insert(from.mentioned.begin(), from.mentioned.end());
+    into.callees.insert(from.callees.begin(), from.callees.end());
+    into.mayDoAnything |= from.mayDoAnything;
+    into.hasPrint |= from.hasPrint;
+    return getSize(into) != size;
+  }
+
+  static void ApplyEffects(const Effects& effects, Definedness& definedness) {
+    if (effects.mayDoAnything) {
+      definedness = Definedness::Unknown();
+      return;
+    }
+
+    for (const auto& name : effects.deleted) {
+      definedness.defined.erase(name);
+    }
+
+    definedness.maybeDefined.insert(effects.assigned.begin(), effects.assigned.end());
+  }
+
+  enum struct FateType : uint8_t {
+    // May be observed
+    LIVE,
+    OVERWRITTEN,
+    DELETED,
+    PROGRAM_END
+  };
+
+  struct Fate final {
+    FateType type;
+    // Index of the delete for DELETED
+    size_t position = 0;
+  };
+
+  static bool IsDefinedValue(const AstNode* value, const Definedness& definedness) {
+    return value->GetType() != AstNodeType::VALUE_IDENTIFIER || definedness.IsDefined(value->As<AstNodeValueIdentifier>()->GetName());
+  }
+
+  std::shared_ptr<AstNode> EliminateDeadStores(const std::shared_ptr<AstNode>& node, Definedness definedness, bool isProgramEnd) {
+    const auto* chain = node->As<AstNodeStatementChain>();
+    if (!chain) {
+      return node;
+    }
+
+    // Forward: nested blocks and definedness before every statement
+    std::vector<std::shared_ptr<AstNode>> statements;
+    std::vector<Definedness> before;
+    for (const auto& statement : chain->GetStatements()) {
+      before.emplace_back(definedness);
+      switch (statement->GetType()) {
+        case AstNodeType::STATEMENT_CONDITION: {
+          const auto* condition = statement->As<AstNodeStatementCondition>();
+          auto code = EliminateDeadStores(condition->GetCode(), definedness, false);
+          statements.emplace_back(At(condition, std::make_shared<AstNodeStatementCondition>(condition->GetCondition(), std::move(code))));
+          break;
+        }
+        case AstNodeType::STATEMENT_LOOP: {
+          const auto* loop = statement->As<AstNodeStatementLoop>();
+          Definedness iteration = definedness;
+          EnterLoop(loop, iteration);
+          auto code = EliminateDeadStores(loop->GetCode(), std::move(iteration), false);
+          statements.emplace_back(At(loop, std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), std::move(code))));
+          break;
+        }
+        case AstNodeType::STATEMENT_FUNC_DECL: {
+          if (m_options.deferFunctionBodies) {
+            statements.emplace_back(statement);
+            break;
+          }
+
+          const auto* declaration = statement->As<AstNodeStatementFunctionDeclaration>();
+          statements.emplace_back(At(declaration, std::make_shared<AstNodeStatementFunctionDeclaration>(
+            declaration->GetFunctionName(), EliminateDeadStores(declaration->GetCode(), Definedness::Unknown(), false))));
+          break;
+        }
+        default: {
+          statements.emplace_back(statement);
+          break;
+        }
+      }
+
+      UpdateDefinedness(statement.get(), definedness);
+    }
+
+    // Backward: what happens next to every variable
+    std::vector<bool> isRemoved(statements.size(), false);
+    std::unordered_map<std::string, Fate> fates;
+    Fate defaultFate(isProgramEnd ? FateType::PROGRAM_END : FateType::LIVE);
+    auto getFate = [&fates, &defaultFate](const std::string& name) {
+      auto iter = fates.find(name);
+      return iter == fates.end() ? defaultFate : iter->second;
+    };
+
+    for (size_t i = statements.size(); i-- > 0;) {
+      const AstNode* statement = statements[i].get();
+      switch (statement->GetType()) {
+        case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+          const auto* modification = statement->As<AstNodeBinaryStatementVarModification>();
+          const auto& name = modification->GetVariableName();
+          const AstNode* value = modification->GetValue().get();
+          bool isAssign = modification->GetOperatorType() == ModificationOperatorType::ASSIGN;
+          Fate fate = getFate(name);
+          bool canFail = !IsDefinedValue(value, before[i]) || (!isAssign && !before[i].IsDefined(name));
+          if (fate.type != FateType::LIVE && !canFail) {
+            if (before[i].IsDefined(name) || fate.type == FateType::PROGRAM_END) {
+              isRemoved[i] = true;
+              break;
+            }
+
+            // Declared here and deleted before anything could see it
+            if (fate.type == FateType::DELETED && before[i].IsUndefined(name)) {
+              isRemoved[i] = true;
+              isRemoved[fate.position] = true;
+              fates[name] = Fate(FateType::LIVE);
+              break;
+            }
+          }
+
+          fates[name] = Fate(isAssign ? FateType::OVERWRITTEN : FateType::LIVE);
+          if (value->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+            fates[value->As<AstNodeValueIdentifier>()->GetName()] = Fate(FateType::LIVE);
+          }
+
+          break;
+        }
+        case AstNodeType::STATEMENT_DELETE: {
+          fates[statement->As<AstNodeStatementDelete>()->GetVariableName()] = Fate(FateType::DELETED, i);
+          break;
+        }
+        case AstNodeType::STATEMENT_FUNC_DECL:
+        case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+          break;
+        }
+        case AstNodeType::STATEMENT_CALL:
+        case AstNodeType::STATEMENT_CONDITION:
+        case AstNodeType::STATEMENT_LOOP: {
+          Effects effects;
+          CollectEffects(statement, effects);
+          if (!effects.mayDoAnything && !effects.hasPrint) {
+            for (const auto& name : effects.mentioned) {
+              fates[name] = Fate(FateType::LIVE);
+            }
+
+            break;
+          }
+
+          fates.clear();
+          defaultFate = Fate(FateType::LIVE);
+          break;
+        }
+        default: {
+          // Print
+          fates.clear();
+          defaultFate = Fate(FateType::LIVE);
+          break;
+        }
+      }
+    }
+
+    std::vector<std::shared_ptr<AstNode>> result;
+    for (size_t i = 0; i < statements.size(); ++i) {
+      if (isRemoved[i]) {
+        ++m_eliminatedCount;
+        continue;
+      }
+
+      result.emplace_back(std::move(statements[i]));
+    }
+
+    return std::make_shared<AstNodeStatementChain>(std::move(result));
+  }
+
+  /*
+
+  Function summaries
+
+  Functions take no arguments and only talk through global variables, so a call is fully described
+  by what the bodies declared under its name read, write and delete, whether they may print, and
+  the same for everything they call in turn. The other passes see calls through these summaries.
+
+  A name declared in exactly one place can only ever be bound to that body. Calls to it inside
+  loops are replaced by a check that it is declared followed by the body itself, as long as the body
+  calls and declares nothing and is small or straight-line (straight-line bodies fuse into one
+  affine update per variable, however long they are). The loop passes then see right through them.
+
+  */
+
+  struct FunctionSummary final {
+    // Everything a call may do
+    Effects effects;
+    size_t declarationCount = 0;
+    // Body of the first declaration
+    std::shared_ptr<AstNode> code;
+    bool isStraightLine = false;
+    bool declaresFunctions = false;
+  };
+
+  // Bodies are summarized on their own first, then closed over the call graph
+  void SummarizeFunctions(const AstNode* root) {
+    m_summaries.clear();
+    std::unordered_map<std::string, FunctionSummary> summaries;
+    CollectSummaries(root, summaries);
+    for (bool isChanged = true; isChanged;) {
+      isChanged = false;
+      for (auto& [name, summary] : summaries) {
+        std::vector<std::string> callees(summary.effects.callees.begin(), summary.effects.callees.end());
+        for (const auto& callee : callees) {
+          auto iter = summaries.find(callee);
+          if (iter != summaries.end() && &iter->second != &summary) {
+            isChanged |= MergeEffects(iter->second.effects, summary.effects);
+          }
+        }
+      }
+    }
+
+    // Whatever the program declares, these are bound to bodies it can't see
+    for (const auto& name : m_options.initialFunctions) {
+      summaries.erase(name);
+    }
+
+    m_summaries = std::move(summaries);
+  }
+
+  // Returns the number of declarations in the subtree
+  size_t CollectSummaries(const AstNode* node, std::unordered_map<std::string, FunctionSummary>& summaries) const {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_CHAIN: {
+        size_t count = 0;
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          count += CollectSummaries(statement.get(), summaries);
+        }
+
+        return count;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        return CollectSummaries(node->As<AstNodeStatementCondition>()->GetCode().get(), summaries);
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        return CollectSummaries(node->As<AstNodeStatementLoop>()->GetCode().get(), summaries);
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        const auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        const std::shared_ptr<AstNode>& code = declaration->GetCode();
+        size_t count = CollectSummaries(code.get(), summaries);
+        FunctionSummary& summary = summaries[declaration->GetFunctionName()];
+        if (summary.declarationCount++ == 0) {
+          std::vector<const AstNodeBinaryStatementVarModification*> modifications;
+          summary.code = code;
+          summary.isStraightLine = CollectModifications(code.get(), modifications);
+        }
+
+        summary.declaresFunctions |= count > 0;
+        CollectEffects(code.get(), summary.effects);
+        return count + 1;
+      }
+      default: return 0;
+    }
+  }
+
+  [[nodiscard]] bool IsInlinable(const FunctionSummary& summary) const {
+    return summary.declarationCount == 1 && !summary.declaresFunctions && summary.effects.callees.empty() && !summary.effects.mayDoAnything
+    && (summary.isStraightLine || CountStatements(summary.code.get()) <= m_options.maxInlineStatements);
+  }
+
+  std::shared_ptr<AstNode> InlineCalls(const std::shared_ptr<AstNode>& node, bool isInLoop) {
+    const auto* chain = node->As<AstNodeStatementChain>();
+    if (!chain) {
+      return node;
+    }
+
+    std::vector<std::shared_ptr<AstNode>> statements;
+    for (const auto& statement : chain->GetStatements()) {
+      switch (statement->GetType()) {
+        case AstNodeType::STATEMENT_CALL: {
+          const auto& name = statement->As<AstNodeStatementCall>()->GetFunctionName();
+          auto iter = m_summaries.find(name);
+          if (!isInLoop || iter == m_summaries.end() || !IsInlinable(iter->second)) {
+            statements.emplace_back(statement);
+            break;
+          }
+
+          statements.emplace_back(At(statement.get(), std::make_shared<AstNodeStatementCheckFunction>(name)));
+          const std::shared_ptr<AstNode>& code = iter->second.code;
+          if (const auto* body = code->As<AstNodeStatementChain>()) {
+            statements.insert(statements.end(), body->GetStatements().begin(), body->GetStatements().end());
+          } else {
+            statements.emplace_back(code);
+          }
+
+          break;
+        }
+        case AstNodeType::STATEMENT_CONDITION: {
+          const auto* condition = statement->As<AstNodeStatementCondition>();
+          statements.emplace_back(At(condition, std::make_shared<AstNodeStatementCondition>(condition->GetCondition(), InlineCalls(condition->GetCode(), isInLoop))));
+          break;
+        }
+        case AstNodeType::STATEMENT_LOOP: {
+          const auto* loop = statement->As<AstNodeStatementLoop>();
+          statements.emplace_back(At(loop, std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), InlineCalls(loop->GetCode(), true))));
+          break;
+        }
+        case AstNodeType::STATEMENT_FUNC_DECL: {
+          if (m_options.deferFunctionBodies) {
+            statements.emplace_back(statement);
+            break;
+          }
+
+          const auto* declaration = statement->As<AstNodeStatementFunctionDeclaration>();
+          statements.emplace_back(At(declaration, std::make_shared<AstNodeStatementFunctionDeclaration>(
+            declaration->GetFunctionName(), InlineCalls(declaration->GetCode(), false))));
+          break;
+        }
+        default: {
+          statements.emplace_back(statement);
+          break;
+        }
+      }
+    }
+
+    return std::make_shared<AstNodeStatementChain>(std::move(statements));
+  }
+
+  /*
+
+  Loop unswitching
+
+  A condition directly in a loop body that only reads variables the loop (and everything it calls)
+  never writes is decided the same way in every iteration. If those variables are also defined
+  before the loop, evaluating it can't fail either, so it's evaluated once up front instead:
+  the loop is split into a copy where the block always runs and one where it never does,
+  guarded by the condition and its negation. Both copies are unswitched further.
+
+  */
+
+  // De Morgan, evaluation order is kept
+  static std::shared_ptr<AstNode> NegateCondition(const std::shared_ptr<AstNode>& node) {
+    const auto* opNode = node->As<AstNodeBinaryOperator>();
+    switch (opNode->GetOperatorType()) {
+      case BinaryOperatorType::EQUALS:
+        return std::make_shared<AstNodeBinaryOperator>(BinaryOperatorType::NOT_EQUALS, opNode->GetLeft(), opNode->GetRight());
+      case BinaryOperatorType::NOT_EQUALS:
+        return std::make_shared<AstNodeBinaryOperator>(BinaryOperatorType::EQUALS, opNode->GetLeft(), opNode->GetRight());
+      case BinaryOperatorType::OR:
+        return std::make_shared<AstNodeBinaryOperator>(BinaryOperatorType::AND, NegateCondition(opNode->GetLeft()), NegateCondition(opNode->GetRight()));
+      case BinaryOperatorType::AND:
+        return std::make_shared<AstNodeBinaryOperator>(BinaryOperatorType::OR, NegateCondition(opNode->GetLeft()), NegateCondition(opNode->GetRight()));
+      default: return nullptr;
+    }
+  }
+
+  std::shared_ptr<AstNode> UnswitchLoops(const std::shared_ptr<AstNode>& node, Definedness definedness) {
+    const auto* chain = node->As<AstNodeStatementChain>();
+    if (!chain) {
+      return node;
+    }
+
+    std::vector<std::shared_ptr<AstNode>> statements;
+    for (const auto& statement : chain->GetStatements()) {
+      switch (statement->GetType()) {
+        case AstNodeType::STATEMENT_CONDITION: {
+          const auto* condition = statement->As<AstNodeStatementCondition>();
+          statements.emplace_back(At(condition, std::make_shared<AstNodeStatementCondition>(
+            condition->GetCondition(), UnswitchLoops(condition->GetCode(), definedness))));
+          break;
+        }
+        case AstNodeType::STATEMENT_LOOP: {
+          const auto* loop = statement->As<AstNodeStatementLoop>();
+          Definedness iteration = definedness;
+          EnterLoop(loop, iteration);
+          auto unswitched = At(loop, std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), UnswitchLoops(loop->GetCode(), std::move(iteration))));
+          Unswitch(unswitched, definedness, 0, statements);
+          break;
+        }
+        case AstNodeType::STATEMENT_FUNC_DECL: {
+          if (m_options.deferFunctionBodies) {
+            statements.emplace_back(statement);
+            break;
+          }
+
+          const auto* declaration = statement->As<AstNodeStatementFunctionDeclaration>();
+          statements.emplace_back(At(declaration, std::make_shared<AstNodeStatementFunctionDeclaration>(
+            declaration->GetFunctionName(), UnswitchLoops(declaration->GetCode(), Definedness::Unknown()))));
+          break;
+        }
+        default: {
+          statements.emplace_back(statement);
+          break;
+        }
+      }
+
+      UpdateDefinedness(statement.get(), definedness);
+    }
+
+    return std::make_shared<AstNodeStatementChain>(std::move(statements));
+  }
+
+  // Appends either the loop itself or the guarded copies to result
+  void Unswitch(const std::shared_ptr<AstNodeStatementLoop>& loop, const Definedness& definedness, uint32_t depth,
+    std::vector<std::shared_ptr<AstNode>>& result) {
+    const auto* body = loop->GetCode()->As<AstNodeStatementChain>();
+    if (!body || depth >= m_options.maxUnswitchDepth || CountStatements(body) > m_options.maxUnswitchStatements) {
+      result.emplace_back(loop);
+      return;
+    }
+
+    Effects effects;
+    CollectEffects(body, effects);
+    if (effects.mayDoAnything) {
+      result.emplace_back(loop);
+      return;
+    }
+
+    const auto& statements = body->GetStatements();
+    auto invariant = std::find_if(statements.begin(), statements.end(), [&](const std::shared_ptr<AstNode>& statement) {
+      if (statement->GetType() != AstNodeType::STATEMENT_CONDITION) {
+        return false;
+      }
+
+      Effects reads;
+      CollectEffects(statement->As<AstNodeStatementCondition>()->GetCondition().get(), reads);
+      return std::all_of(reads.mentioned.begin(), reads.mentioned.end(), [&](const std::string& name) {
+        return !effects.written.contains(name) && definedness.IsDefined(name);
+      });
+    });
+
+    if (invariant == statements.end()) {
+      result.emplace_back(loop);
+      return;
+    }
+
+    const auto* condition = (*invariant)->As<AstNodeStatementCondition>();
+    std::vector<std::shared_ptr<AstNode>> takenStatements;
+    std::vector<std::shared_ptr<AstNode>> skippedStatements;
+    for (auto iter = statements.begin(); iter != statements.end(); ++iter) {
+      if (iter != invariant) {
+        takenStatements.emplace_back(*iter);
+        skippedStatements.emplace_back(*iter);
+        continue;
+      }
+
+      const auto* block = condition->GetCode()->As<AstNodeStatementChain>();
+      if (block) {
+        takenStatements.insert(takenStatements.end(), block->GetStatements().begin(), block->GetStatements().end());
+      } else {
+        takenStatements.emplace_back(condition->GetCode());
+      }
+    }
+
+    std::vector<std::shared_ptr<AstNode>> taken;
+    Unswitch(At(loop.get(), std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), std::make_shared<AstNodeStatementChain>(std::move(takenStatements)))),
+      definedness, depth + 1, taken);
+    std::vector<std::shared_ptr<AstNode>> skipped;
+    Unswitch(At(loop.get(), std::make_shared<AstNodeStatementLoop>(loop->GetInitValue(), std::make_shared<AstNodeStatementChain>(std::move(skippedStatements)))),
+      definedness, depth + 1, skipped);
+    result.emplace_back(At(condition, std::make_shared<AstNodeStatementCondition>(condition->GetCondition(), std::make_shared<AstNodeStatementChain>(std::move(taken)))));
+    result.emplace_back(At(condition, std::make_shared<AstNodeStatementCondition>(NegateCondition(condition->GetCondition()), std::make_shared<AstNodeStatementChain>(std::move(skipped)))));
+  }
+
+  /*
+
+  Modification fusion
+
+  Within a run of modifications every touched variable is tracked as multiplier * $source + addend,
+  where the source is a value from before the run (possibly the variable itself) or there is none.
+  The run is emitted as one update per variable in order of first modification, which is also
+  the order in which the original statements would have declared them.
+
+  Errors don't need to happen at the same statement, they are all "Undefined variable." and nothing
+  is observable before them. They only have to happen for the same inputs, so an update never drops
+  a source it has read, and a variable that was first modified with add/sub/mult still requires
+  its target to be defined. Anything that can't be expressed that way flushes the run.
+
+  */
+
+  struct Update final {
+    std::string target;
+    bool requiresTarget;
+    // Empty if the value is a constant
+    std::string source;
+    int64_t multiplier;
+    int64_t addend;
+    // The statement itself while the update stands for just one
+    std::shared_ptr<AstNode> original;
+    size_t statementCount;
+    // Of the first fused statement
+    SourcePosition position;
+
+    [[nodiscard]] bool IsConstant() const {
+      return source.empty() || multiplier == 0;
+    }
+  };
+
+  static Update* FindUpdate(std::vector<Update>& updates, const std::string& name) {
+    auto iter = std::find_if(updates.begin(), updates.end(), [&name](const Update& update) {
+      return update.target == name;
+    });
+    return iter == updates.end() ? nullptr : &*iter;
+  }
+
+  // Returns false if the statement can't join the run
+  static bool TryFuse(const std::shared_ptr<AstNode>& statement, std::vector<Update>& updates) {
+    const auto* modification = statement->As<AstNodeBinaryStatementVarModification>();
+    const auto& target = modification->GetVariableName();
+    ModificationOperatorType opType = modification->GetOperatorType();
+
+    // The value as an update of its own
+    Update value(target, false, {}, 0, 0, nullptr, 0, statement->GetSourcePosition());
+    bool isForwarded = false;
+    const AstNode* valueNode = modification->GetValue().get();
+    if (valueNode->GetType() == AstNodeType::VALUE_NUMBER) {
+      value.addend = valueNode->As<AstNodeValueNumber>()->GetValue();
+    } else if (valueNode->GetType() == AstNodeType::VALUE_IDENTIFIER) {
+      const auto& name = valueNode->As<AstNodeValueIdentifier>()->GetName();
+      if (const Update* update = FindUpdate(updates, name)) {
+        // Reading a variable the run has already changed is only possible if its new value is known
+        if (!update->IsConstant()) {
+          return false;
+        }
+
+        value.addend = update->addend;
+        isForwarded = true;
+      } else {
+        value.source = name;
+        value.multiplier = 1;
+      }
+    } else {
+      return false;
+    }
+
+    // Untouched so far means its value from before the run, unless it's only assigned
+    bool isAssign = opType == ModificationOperatorType::ASSIGN;
+    Update* existing = FindUpdate(updates, target);
+    Update current = existing ? *existing : Update(target, !isAssign, isAssign ? std::string() : target, 1, 0, nullptr, 0, statement->GetSourcePosition());
+    Update result = current;
+    switch (opType) {
+      case ModificationOperatorType::ASSIGN: {
+        // The old value is dropped, which is fine as long as its source is checked anyway
+        if (!current.source.empty() && !(current.source == target && current.requiresTarget)) {
+          return false;
+        }
+
+        result.source = value.source;
+        result.multiplier = value.multiplier;
+        result.addend = value.addend;
+        break;
+      }
+      case ModificationOperatorType::ADD:
+      case ModificationOperatorType::SUBTRACT: {
+        if (!current.source.empty() && !value.source.empty() && current.source != value.source) {
+          return false;
+        }
+
+        bool isAdd = opType == ModificationOperatorType::ADD;
+        auto combine = isAdd ? WrappingAdd : WrappingSubtract;
+        if (current.source.empty()) {
+          result.source = value.source;
+          result.multiplier = isAdd ? value.multiplier : WrappingSubtract(0, value.multiplier);
+        } else {
+          result.multiplier = combine(current.multiplier, value.multiplier);
+        }
+
+        result.addend = combine(current.addend, value.addend);
+        break;
+      }
+      case ModificationOperatorType::MULTIPLY: {
+        if (value.source.empty()) {
+          result.multiplier = WrappingMultiply(current.multiplier, value.addend);
+          result.addend = WrappingMultiply(current.addend, value.addend);
+        } else if (current.source.empty()) {
+          result.source = value.source;
+          result.multiplier = current.addend;
+          result.addend = 0;
+        } else {
+          return false;
+        }
+
+        break;
+      }
+      default: return false;
+    }
+
+    // A forwarded read can't be left to the original statement, the update it read from may be emitted first
+    result.original = existing || isForwarded ? nullptr : statement;
+    result.statementCount = current.statementCount + 1;
+    if (existing) {
+      *existing = std::move(result);
+    } else {
+      updates.emplace_back(std::move(result));
+    }
+
+    return true;
+  }
+
+  void Flush(std::vector<Update>& updates, std::vector<std::shared_ptr<AstNode>>& statements) {
+    for (auto& update : updates) {
+      if (update.original) {
+        statements.emplace_back(std::move(update.original));
+        continue;
+      }
+
+      auto& fused = statements.emplace_back(std::make_shared<AstNodeStatementAffineModification>(
+        update.target, update.requiresTarget, update.source, update.multiplier, update.addend));
+      fused->SetSourcePosition(update.position);
+      m_eliminatedCount += update.statementCount - 1;
+    }
+
+    updates.clear();
+  }
+
+  std::vector<std::shared_ptr<AstNode>> FuseModifications(const std::vector<std::shared_ptr<AstNode>>& statements) {
+    std::vector<std::shared_ptr<AstNode>> result;
+    std::vector<Update> updates;
+    for (const auto& statement : statements) {
+      bool isModification = statement->GetType() == AstNodeType::STATEMENT_VAR_MODIFICATION;
+      if (isModification && TryFuse(statement, updates)) {
+        continue;
+      }
+
+      Flush(updates, result);
+      // A fresh run may accept it, e.g. x add $x after x was changed
+      if (!isModification || !TryFuse(statement, updates)) {
+        result.emplace_back(statement);
+      }
+    }
+
+    Flush(updates, result);
+    return result;
+  }
+
+private:
+  OptimizerOptions m_options;
+  size_t m_eliminatedCount = 0;
+  // Function name -> summary of all its declarations
+  std::unordered_map<std::string, FunctionSummary> m_summaries;
+};
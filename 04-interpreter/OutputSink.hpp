@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Where print goes. Lines are formatted with to_chars into a preallocated buffer, which is handed
+// to the target when it fills up or on Flush, so a whole print is a single write when it fits.
+// Backends flush at the end of every print, anything written to the same fd through iostreams
+// has to be flushed before the run starts
+struct OutputSink final {
+  using Target = std::function<void(std::string_view)>;
+
+  static constexpr size_t kDefaultCapacity = size_t(1) << 20;
+
+  explicit OutputSink(Target target, size_t capacity = kDefaultCapacity)
+  : m_target(std::move(target))
+  , m_buffer(std::make_unique<char[]>(capacity))
+  , m_capacity(capacity) {
+  }
+
+  // The fd isn't closed
+  static OutputSink ToFd(int fd, size_t capacity = kDefaultCapacity) {
+    return OutputSink([fd](std::string_view text) { WriteAll(fd, text); }, capacity);
+  }
+
+  // Appends to target, which has to outlive the sink. The buffer only saves reallocations here, so it's small
+  static OutputSink ToString(std::string& target, size_t capacity = size_t(1) << 12) {
+    return OutputSink([&target](std::string_view text) { target.append(text); }, capacity);
+  }
+
+  // Standard output, the default of every backend. One per process and not locked, so one thread at a time
+  static OutputSink& Standard() {
+    static OutputSink sink = ToFd(1);
+    return sink;
+  }
+
+  OutputSink(const OutputSink&) = delete;
+  OutputSink& operator=(const OutputSink&) = delete;
+
+  ~OutputSink() {
+    Flush();
+  }
+
+  void Write(std::string_view text) {
+    if (m_capacity - m_size < text.size()) {
+      Flush();
+      if (text.size() > m_capacity) {
+        m_target(text);
+        return;
+      }
+    }
+
+    std::memcpy(m_buffer.get() + m_size, text.data(), text.size());
+    m_size += text.size();
+  }
+
+  // "name = value\n"
+  void WriteVariable(std::string_view name, int64_t value) {
+    // " = ", up to 20 characters of the value and the new line
+    size_t maxSize = name.size() + 24;
+    if (m_capacity - m_size < maxSize) {
+      Flush();
+      if (maxSize > m_capacity) {
+        char digits[24];
+        Write(name);
+        Write(" = ");
+        Write(std::string_view(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr));
+        Write("\n");
+        return;
+      }
+    }
+
+    char* output = m_buffer.get() + m_size;
+    std::memcpy(output, name.data(), name.size());
+    output += name.size();
+    std::memcpy(output, " = ", 3);
+    output += 3;
+    output = std::to_chars(output, output + 20, value).ptr;
+    *output++ = '\n';
+    m_size = static_cast<size_t>(output - m_buffer.get());
+  }
+
+  void Flush() {
+    if (m_size > 0) {
+      m_target(std::string_view(m_buffer.get(), m_size));
+      m_size = 0;
+    }
+  }
+
+private:
+  static void WriteAll(int fd, std::string_view text) {
+    while (!text.empty()) {
+#if defined(_WIN32)
+      auto written = _write(fd, text.data(), static_cast<unsigned>(text.size()));
+#else
+      auto written = ::write(fd, text.data(), text.size());
+#endif
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        // Nobody to tell, iostreams drop it as well
+        return;
+      }
+
+      text.remove_prefix(static_cast<size_t>(written));
+    }
+  }
+
+private:
+  Target m_target;
+  std::unique_ptr<char[]> m_buffer;
+  size_t m_capacity;
+  size_t m_size = 0;
+};
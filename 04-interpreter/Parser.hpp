@@ -286,36 +286,39 @@ private:
   | StatementLoop
 */
 
-  static std::shared_ptr<AstNode> ParseStatementChain(ParserView& view) {
-    std::vector<std::shared_ptr<AstNode>> statements;
+  static std::shared_ptr<AstNode> ParseStatement(ParserView& view) {
+    if (auto statement = ParseStatementPrint(view)) {
+      return statement;
+    }
 
-    while (true) {
-      if (auto statement = ParseStatementPrint(view)) {
-        statements.emplace_back(std::move(statement));
-        continue;
-      }
+    if (auto statement = ParseStatementDelete(view)) {
+      return statement;
+    }
 
-      if (auto statement = ParseStatementDelete(view)) {
-        statements.emplace_back(std::move(statement));
-        continue;
-      }
+    if (auto statement = ParseStatementIdentifierBased(view)) {
+      return statement;
+    }
 
-      if (auto statement = ParseStatementIdentifierBased(view)) {
-        statements.emplace_back(std::move(statement));
-        continue;
-      }
+    if (auto statement = ParseStatementCondition(view)) {
+      return statement;
+    }
 
-      if (auto statement = ParseStatementCondition(view)) {
-        statements.emplace_back(std::move(statement));
-        continue;
-      }
+    return ParseStatementLoop(view);
+  }
 
-      if (auto statement = ParseStatementLoop(view)) {
-        statements.emplace_back(std::move(statement));
-        continue;
+  static std::shared_ptr<AstNode> ParseStatementChain(ParserView& view) {
+    std::vector<std::shared_ptr<AstNode>> statements;
+
+    while (view.HasTokens()) {
+      // A statement starts where its first token does
+      SourcePosition position = view.Next()->GetSourcePosition();
+      auto statement = ParseStatement(view);
+      if (!statement) {
+        break;
       }
 
-      break;
+      statement->SetSourcePosition(position);
+      statements.emplace_back(std::move(statement));
     }
 
     return std::make_shared<AstNodeStatementChain>(std::move(statements));
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PERF_COUNTERS_SUPPORTED 1
+#else
+#define PERF_COUNTERS_SUPPORTED 0
+#endif
+
+/*
+
+Hardware performance counters
+
+Counts cycles, instructions, cache references and misses, and branches and misses of this process
+(user space only, threads included once they have been joined) over named phases. Every counter is
+opened on its own, so whatever the kernel or the container refuses is reported as missing and the
+rest still works. With none of them, phases are still timed. When there are more counters than the
+PMU has, the kernel multiplexes them and the counts are scaled up to the whole phase.
+
+*/
+
+enum struct PerfCounter : uint8_t {
+  CYCLES,
+  INSTRUCTIONS,
+  CACHE_REFERENCES,
+  CACHE_MISSES,
+  BRANCHES,
+  BRANCH_MISSES,
+
+  COUNT
+};
+
+// One phase, counters that couldn't be opened are nullopt
+struct PerfReading final {
+  std::string phase;
+  double seconds = 0;
+  std::array<std::optional<uint64_t>, size_t(PerfCounter::COUNT)> counts;
+
+  [[nodiscard]] std::optional<uint64_t> Get(PerfCounter counter) const {
+    return counts[size_t(counter)];
+  }
+
+  // Nullopt if either is missing or the denominator is zero
+  [[nodiscard]] std::optional<double> GetRatio(PerfCounter numerator, PerfCounter denominator) const {
+    if (!Get(numerator) || !Get(denominator) || *Get(denominator) == 0) {
+      return std::nullopt;
+    }
+
+    return double(*Get(numerator)) / double(*Get(denominator));
+  }
+};
+
+struct PerfCounters final {
+  PerfCounters() {
+    m_fds.fill(-1);
+#if PERF_COUNTERS_SUPPORTED
+    static constexpr uint64_t kConfigs[] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (size_t i = 0; i < m_fds.size(); ++i) {
+      perf_event_attr attributes;
+      std::memset(&attributes, 0, sizeof(attributes));
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.size = sizeof(attributes);
+      attributes.config = kConfigs[i];
+      attributes.disabled = 1;
+      attributes.inherit = 1;
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      m_fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+      if (m_fds[i] < 0 && m_error.empty()) {
+        m_error = std::string("perf_event_open: ") + std::strerror(errno);
+      }
+    }
+#else
+    m_error = "not supported on this platform";
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#if PERF_COUNTERS_SUPPORTED
+    for (int fd : m_fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  // False if no hardware counter could be opened, phases are only timed then
+  [[nodiscard]] bool IsAvailable() const {
+    for (int fd : m_fds) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Why the first counter that failed did, empty if none did
+  [[nodiscard]] const std::string& GetError() const {
+    return m_error;
+  }
+
+  // Ends the current phase if there is one
+  void Begin(std::string phase) {
+    End();
+    m_readings.emplace_back().phase = std::move(phase);
+    m_isRunning = true;
+#if PERF_COUNTERS_SUPPORTED
+    for (int fd : m_fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+    m_start = Clock::now();
+  }
+
+  void End() {
+    if (!m_isRunning) {
+      return;
+    }
+
+    PerfReading& reading = m_readings.back();
+    reading.seconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+    m_isRunning = false;
+#if PERF_COUNTERS_SUPPORTED
+    for (size_t i = 0; i < m_fds.size(); ++i) {
+      if (m_fds[i] < 0) {
+        continue;
+      }
+
+      ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      // value, time enabled, time running
+      uint64_t values[3] = {};
+      // Never scheduled, the PMU was taken by someone else
+      if (read(m_fds[i], values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        continue;
+      }
+
+      // Multiplexed counters ran for part of the phase only
+      reading.counts[i] = values[2] >= values[1]
+        ? values[0]
+        : static_cast<uint64_t>(double(values[0]) * double(values[1]) / double(values[2]));
+    }
+#endif
+  }
+
+  [[nodiscard]] const std::vector<PerfReading>& GetReadings() const {
+    return m_readings;
+  }
+
+  // A table of the phases: time, IPC and miss rates, n/a for whatever isn't counted
+  void WriteReport(std::ostream& output) const {
+    output << std::left << std::setw(10) << "phase" << std::right
+      << std::setw(12) << "time ms"
+      << std::setw(16) << "cycles"
+      << std::setw(16) << "instructions"
+      << std::setw(8) << "IPC"
+      << std::setw(14) << "cache misses"
+      << std::setw(10) << "rate"
+      << std::setw(14) << "branch misses"
+      << std::setw(10) << "rate" << '\n';
+
+    for (const PerfReading& reading : m_readings) {
+      output << std::left << std::setw(10) << reading.phase << std::right
+        << std::setw(12) << std::fixed << std::setprecision(3) << reading.seconds * 1000;
+      WriteCount(output, 16, reading.Get(PerfCounter::CYCLES));
+      WriteCount(output, 16, reading.Get(PerfCounter::INSTRUCTIONS));
+      WriteRatio(output, 8, reading.GetRatio(PerfCounter::INSTRUCTIONS, PerfCounter::CYCLES), 1, "");
+      WriteCount(output, 14, reading.Get(PerfCounter::CACHE_MISSES));
+      WriteRatio(output, 10, reading.GetRatio(PerfCounter::CACHE_MISSES, PerfCounter::CACHE_REFERENCES), 100, " %");
+      WriteCount(output, 14, reading.Get(PerfCounter::BRANCH_MISSES));
+      WriteRatio(output, 10, reading.GetRatio(PerfCounter::BRANCH_MISSES, PerfCounter::BRANCHES), 100, " %");
+      output << '\n';
+    }
+
+    if (!IsAvailable()) {
+      output << "Hardware counters are unavailable (" << m_error << "), only times are reported\n";
+    }
+  }
+
+  // {"available": bool, "error": string, "phases": [{"name", "seconds", counters..., ratios...}]}, null for whatever isn't counted
+  void WriteJson(std::ostream& output) const {
+    static constexpr const char* kNames[] = {
+      "cycles", "instructions", "cacheReferences", "cacheMisses", "branches", "branchMisses"
+    };
+
+    output << "{\"available\": " << (IsAvailable() ? "true" : "false")
+      << ", \"error\": \"" << m_error << "\", \"phases\": [";
+    for (size_t i = 0; i < m_readings.size(); ++i) {
+      const PerfReading& reading = m_readings[i];
+      output << (i == 0 ? "" : ", ") << "{\"name\": \"" << reading.phase << "\", \"seconds\": "
+        << std::setprecision(9) << std::fixed << reading.seconds;
+      for (size_t counter = 0; counter < reading.counts.size(); ++counter) {
+        output << ", \"" << kNames[counter] << "\": ";
+        if (reading.counts[counter]) {
+          output << *reading.counts[counter];
+        } else {
+          output << "null";
+        }
+      }
+
+      WriteJsonRatio(output, "ipc", reading.GetRatio(PerfCounter::INSTRUCTIONS, PerfCounter::CYCLES));
+      WriteJsonRatio(output, "cacheMissRate", reading.GetRatio(PerfCounter::CACHE_MISSES, PerfCounter::CACHE_REFERENCES));
+      WriteJsonRatio(output, "branchMissRate", reading.GetRatio(PerfCounter::BRANCH_MISSES, PerfCounter::BRANCHES));
+      output << '}';
+    }
+
+    output << "]}\n";
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static void WriteCount(std::ostream& output, int width, std::optional<uint64_t> count) {
+    if (count) {
+      output << std::setw(width) << *count;
+    } else {
+      output << std::setw(width) << "n/a";
+    }
+  }
+
+  static void WriteRatio(std::ostream& output, int width, std::optional<double> ratio, double scale, const char* unit) {
+    if (ratio) {
+      output << std::setw(width - static_cast<int>(std::strlen(unit))) << std::fixed << std::setprecision(2) << *ratio * scale << unit;
+    } else {
+      output << std::setw(width) << "n/a";
+    }
+  }
+
+  static void WriteJsonRatio(std::ostream& output, const char* name, std::optional<double> ratio) {
+    output << ", \"" << name << "\": ";
+    if (ratio) {
+      output << std::setprecision(6) << *ratio;
+    } else {
+      output << "null";
+    }
+  }
+
+private:
+  std::array<int, size_t(PerfCounter::COUNT)> m_fds;
+  std::string m_error;
+  std::vector<PerfReading> m_readings;
+  Clock::time_point m_start;
+  bool m_isRunning = false;
+};
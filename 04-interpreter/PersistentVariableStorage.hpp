@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+
+Persistent variable storage
+
+The same interface as VariableStorage, but Fork gives a copy that shares everything with the original
+until either side writes. Slots live in chunks of 64 behind a table of chunk pointers:
+
+  Fork - shares the table, O(1)
+  first write after a fork - copies the table (a pointer per 64 slots) and the chunk written to
+  later writes - copy the chunk they touch if it's still shared, then write in place
+
+A storage remembers which of the table and chunks it may write, shared ones are never written.
+So forks can run on different threads, as long as each of them stays on one.
+
+*/
+
+struct PersistentVariableStorage final {
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  PersistentVariableStorage()
+  : m_table(std::make_shared<Table>()) {
+  }
+
+  // The table stays where it is, and so do the pointers into it
+  PersistentVariableStorage(PersistentVariableStorage&&) noexcept = default;
+  PersistentVariableStorage& operator=(PersistentVariableStorage&&) noexcept = default;
+
+  // Sharing has to be visible to both sides, so copies go through Fork
+  PersistentVariableStorage(const PersistentVariableStorage&) = delete;
+  PersistentVariableStorage& operator=(const PersistentVariableStorage&) = delete;
+
+  [[nodiscard]] PersistentVariableStorage Fork() {
+    m_writable = nullptr;
+    return PersistentVariableStorage(m_table, m_slotCount, m_head, m_tail, m_count);
+  }
+
+  void Resize(size_t slotCount) {
+    OwnTable();
+    m_table->chunks.resize((slotCount + kChunkMask) >> kChunkShift);
+    m_table->writable.resize(m_table->chunks.size(), nullptr);
+    for (size_t i = 0; i < m_table->chunks.size(); ++i) {
+      if (!m_table->chunks[i]) {
+        m_table->chunks[i] = std::make_shared<Chunk>();
+        m_table->writable[i] = m_table->chunks[i].get();
+      }
+    }
+
+    m_chunks = m_table->chunks.data();
+    m_writable = m_table->writable.data();
+    m_slotCount = slotCount;
+  }
+
+  [[nodiscard]] size_t GetSlotCount() const {
+    return m_slotCount;
+  }
+
+  [[nodiscard]] size_t GetDefinedCount() const {
+    return m_count;
+  }
+
+  [[nodiscard]] bool IsDefined(uint32_t slot) const {
+    assert(slot < m_slotCount);
+    return (GetChunk(slot).isDefined >> (slot & kChunkMask)) & 1;
+  }
+
+  [[nodiscard]] int64_t Get(uint32_t slot) const {
+    assert(IsDefined(slot));
+    return GetChunk(slot).values[slot & kChunkMask];
+  }
+
+  [[nodiscard]] int64_t& At(uint32_t slot) {
+    assert(IsDefined(slot));
+    return GetWritableChunk(slot).values[slot & kChunkMask];
+  }
+
+  // Reassigns a defined slot or declares it at the end of the print order
+  void Set(uint32_t slot, int64_t value) {
+    if (!IsDefined(slot)) {
+      Define(slot);
+    }
+
+    GetWritableChunk(slot).values[slot & kChunkMask] = value;
+  }
+
+  void Erase(uint32_t slot) {
+    assert(IsDefined(slot));
+    Link link = GetLink(slot);
+    (link.prev == kNone ? m_head : GetWritableLink(link.prev).next) = link.next;
+    (link.next == kNone ? m_tail : GetWritableLink(link.next).prev) = link.prev;
+    GetWritableChunk(slot).isDefined &= ~(uint64_t(1) << (slot & kChunkMask));
+    --m_count;
+  }
+
+  // Visits (slot, value) in declaration order
+  template <typename Func>
+  void ForEach(Func func) const {
+    for (uint32_t slot = m_head; slot != kNone; slot = GetLink(slot).next) {
+      func(slot, Get(slot));
+    }
+  }
+
+private:
+  static constexpr uint32_t kChunkShift = 6;
+  static constexpr uint32_t kChunkMask = (1u << kChunkShift) - 1;
+
+  struct Link final {
+    uint32_t prev = kNone;
+    uint32_t next = kNone;
+  };
+
+  struct Chunk final {
+    int64_t values[kChunkMask + 1] = {};
+    Link links[kChunkMask + 1];
+    uint64_t isDefined = 0;
+  };
+
+  struct Table final {
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    // The chunk if nothing else refers to it, null otherwise. Cleared on copy, a copied table shares all of its chunks
+    std::vector<Chunk*> writable;
+  };
+
+  PersistentVariableStorage(std::shared_ptr<Table> table, size_t slotCount, uint32_t head, uint32_t tail, size_t count)
+  : m_table(std::move(table))
+  , m_chunks(m_table->chunks.data())
+  , m_slotCount(slotCount)
+  , m_head(head)
+  , m_tail(tail)
+  , m_count(count) {
+  }
+
+  [[nodiscard]] const Chunk& GetChunk(uint32_t slot) const {
+    return *m_chunks[slot >> kChunkShift];
+  }
+
+  Chunk& GetWritableChunk(uint32_t slot) {
+    size_t index = slot >> kChunkShift;
+    Chunk* chunk = m_writable ? m_writable[index] : nullptr;
+    return chunk ? *chunk : CopyChunk(index);
+  }
+
+  Chunk& CopyChunk(size_t index) {
+    OwnTable();
+    m_chunks[index] = std::make_shared<Chunk>(*m_chunks[index]);
+    m_writable[index] = m_chunks[index].get();
+    return *m_writable[index];
+  }
+
+  void OwnTable() {
+    if (!m_writable) {
+      auto table = std::make_shared<Table>();
+      table->chunks = m_table->chunks;
+      table->writable.resize(table->chunks.size(), nullptr);
+      m_table = std::move(table);
+      m_chunks = m_table->chunks.data();
+      m_writable = m_table->writable.data();
+    }
+  }
+
+  [[nodiscard]] Link GetLink(uint32_t slot) const {
+    return GetChunk(slot).links[slot & kChunkMask];
+  }
+
+  Link& GetWritableLink(uint32_t slot) {
+    return GetWritableChunk(slot).links[slot & kChunkMask];
+  }
+
+  void Define(uint32_t slot) {
+    GetWritableLink(slot) = Link(m_tail, kNone);
+    (m_tail == kNone ? m_head : GetWritableLink(m_tail).next) = slot;
+    m_tail = slot;
+    GetWritableChunk(slot).isDefined |= uint64_t(1) << (slot & kChunkMask);
+    ++m_count;
+  }
+
+private:
+  std::shared_ptr<Table> m_table;
+  // m_table->chunks.data() and m_table->writable.data(), save a load or two on every access.
+  // m_writable is null while the table is shared
+  std::shared_ptr<Chunk>* m_chunks = nullptr;
+  Chunk** m_writable = nullptr;
+  size_t m_slotCount = 0;
+  uint32_t m_head = kNone;
+  uint32_t m_tail = kNone;
+  size_t m_count = 0;
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "SymbolTable.hpp"
+
+/*
+
+Profiler
+
+An interpreter with ProfilerHooks reports every statement it runs with Enter/Exit (and loop passes
+with CountIterations), the profiler keeps a stack of open statements and charges each one its wall time:
+  total - from Enter to Exit, counted once per outermost entry so recursion isn't counted twice
+  self - total minus whatever the nested statements took
+
+Calls and loops also open a frame of the folded stack ("main;f;loop@3:5"), self time of everything
+inside goes to the innermost frame. Recursion stays in the frame of the outermost entry, otherwise
+a deep recursion would make a stack as deep as itself.
+
+*/
+
+struct Profiler final {
+  struct NodeStats final {
+    uint64_t count = 0;
+    uint64_t iterations = 0;
+    uint64_t totalNs = 0;
+    uint64_t selfNs = 0;
+    uint32_t active = 0;
+  };
+
+  struct FunctionStats final {
+    uint64_t calls = 0;
+    uint64_t totalNs = 0;
+    uint32_t active = 0;
+  };
+
+  explicit Profiler(const SymbolTable& functions)
+  : m_functionNames(functions)
+  , m_functions(functions.GetSize()) {
+    m_stacks.emplace_back(0, "main", 0);
+  }
+
+  void Enter(const AstNode* node) {
+    NodeStats& stats = m_nodes[node];
+    FunctionStats* function = nullptr;
+    uint32_t stack = m_open.empty() ? 0 : m_open.back().stack;
+    if (node->GetType() == AstNodeType::STATEMENT_CALL) {
+      uint32_t slot = node->As<AstNodeStatementCall>()->GetSlot();
+      function = &m_functions[slot];
+      if (function->active == 0) {
+        stack = GetStack(stack, function, node);
+      }
+
+      ++function->calls;
+      ++function->active;
+    } else if ((node->GetType() == AstNodeType::STATEMENT_LOOP || node->GetType() == AstNodeType::STATEMENT_AFFINE_LOOP) && stats.active == 0) {
+      stack = GetStack(stack, &stats, node);
+    }
+
+    ++stats.count;
+    ++stats.active;
+    m_open.emplace_back(node, &stats, function, stack, Clock::now(), 0);
+  }
+
+  void Exit() {
+    OpenStatement statement = m_open.back();
+    m_open.pop_back();
+    auto totalNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - statement.start).count());
+    uint64_t selfNs = totalNs - std::min(totalNs, statement.childNs);
+    if (!m_open.empty()) {
+      m_open.back().childNs += totalNs;
+    }
+
+    statement.stats->selfNs += selfNs;
+    if (--statement.stats->active == 0) {
+      statement.stats->totalNs += totalNs;
+    }
+
+    if (statement.function && --statement.function->active == 0) {
+      statement.function->totalNs += totalNs;
+    }
+
+    m_stacks[statement.stack].selfNs += selfNs;
+  }
+
+  // Passes of the innermost open loop
+  void CountIterations(uint64_t count) {
+    m_open.back().stats->iterations += count;
+  }
+
+  // Closes whatever a failed or cancelled run left open
+  void Stop() {
+    while (!m_open.empty()) {
+      Exit();
+    }
+  }
+
+  // Statements ranked by self time, then functions and loops by total time
+  void WriteReport(std::ostream& output, size_t limit = 20) const {
+    std::vector<std::pair<const AstNode*, const NodeStats*>> nodes;
+    for (const auto& [node, stats] : m_nodes) {
+      nodes.emplace_back(node, &stats);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const auto& left, const auto& right) {
+      return left.second->selfNs > right.second->selfNs;
+    });
+
+    output << std::fixed << std::setprecision(3);
+    output << "Hot spots:\n";
+    output << std::setw(12) << "self ms" << std::setw(12) << "total ms" << std::setw(12) << "count" << "  location  statement\n";
+    for (size_t i = 0; i < nodes.size() && i < limit; ++i) {
+      const auto& [node, stats] = nodes[i];
+      output << std::setw(12) << ToMilliseconds(stats->selfNs) << std::setw(12) << ToMilliseconds(stats->totalNs)
+        << std::setw(12) << stats->count << "  " << std::left << std::setw(8) << FormatPosition(node->GetSourcePosition())
+        << std::right << "  " << Describe(node) << '\n';
+    }
+
+    output << "\nFunctions:\n";
+    output << std::setw(12) << "total ms" << std::setw(12) << "calls" << "  name\n";
+    for (uint32_t slot = 0; slot < m_functions.size(); ++slot) {
+      if (m_functions[slot].calls > 0) {
+        output << std::setw(12) << ToMilliseconds(m_functions[slot].totalNs) << std::setw(12) << m_functions[slot].calls
+          << "  " << m_functionNames.GetName(slot) << '\n';
+      }
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const auto& left, const auto& right) {
+      return left.second->totalNs > right.second->totalNs;
+    });
+
+    output << "\nLoops:\n";
+    output << std::setw(12) << "total ms" << std::setw(12) << "count" << std::setw(12) << "iterations" << "  location\n";
+    for (const auto& [node, stats] : nodes) {
+      if (node->GetType() == AstNodeType::STATEMENT_LOOP || node->GetType() == AstNodeType::STATEMENT_AFFINE_LOOP) {
+        output << std::setw(12) << ToMilliseconds(stats->totalNs) << std::setw(12) << stats->count
+          << std::setw(12) << stats->iterations << "  " << FormatPosition(node->GetSourcePosition()) << '\n';
+      }
+    }
+
+    output << std::defaultfloat;
+  }
+
+  // "main;f;loop@3:5 <self ns>" per line, as flamegraph.pl and friends take it
+  void WriteFoldedStacks(std::ostream& output) const {
+    for (uint32_t stack = 0; stack < m_stacks.size(); ++stack) {
+      if (m_stacks[stack].selfNs > 0) {
+        output << GetStackPath(stack) << ' ' << m_stacks[stack].selfNs << '\n';
+      }
+    }
+  }
+
+  [[nodiscard]] const std::unordered_map<const AstNode*, NodeStats>& GetNodes() const {
+    return m_nodes;
+  }
+
+  [[nodiscard]] const std::vector<FunctionStats>& GetFunctions() const {
+    return m_functions;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct OpenStatement final {
+    const AstNode* node;
+    NodeStats* stats;
+    FunctionStats* function;
+    uint32_t stack;
+    Clock::time_point start;
+    uint64_t childNs;
+  };
+
+  struct StackFrame final {
+    uint32_t parent;
+    std::string name;
+    uint64_t selfNs;
+  };
+
+  struct StackKey final {
+    uint32_t parent;
+    // Stats of the call or loop that opened the frame, stable since neither container reallocates them
+    const void* owner;
+
+    bool operator==(const StackKey& other) const = default;
+  };
+
+  struct StackKeyHash final {
+    size_t operator()(const StackKey& key) const {
+      return std::hash<const void*>()(key.owner) ^ (size_t(key.parent) * 0x9E3779B97F4A7C15ull);
+    }
+  };
+
+  uint32_t GetStack(uint32_t parent, const void* owner, const AstNode* node) {
+    auto [iter, isInserted] = m_stackIndices.try_emplace(StackKey(parent, owner), static_cast<uint32_t>(m_stacks.size()));
+    if (isInserted) {
+      std::string name = node->GetType() == AstNodeType::STATEMENT_CALL
+      ? m_functionNames.GetName(node->As<AstNodeStatementCall>()->GetSlot())
+      : "loop@" + FormatPosition(node->GetSourcePosition());
+      m_stacks.emplace_back(parent, std::move(name), 0);
+    }
+
+    return iter->second;
+  }
+
+  [[nodiscard]] std::string GetStackPath(uint32_t stack) const {
+    std::string path = m_stacks[stack].name;
+    for (; stack != 0; stack = m_stacks[stack].parent) {
+      path = m_stacks[m_stacks[stack].parent].name + ';' + path;
+    }
+
+    return path;
+  }
+
+  static double ToMilliseconds(uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+  }
+
+  static std::string FormatPosition(SourcePosition position) {
+    if (position.line == 0) {
+      return "?";
+    }
+
+    return std::to_string(position.line) + ':' + std::to_string(position.column);
+  }
+
+  static std::string Describe(const AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::STATEMENT_PRINT: return "print";
+      case AstNodeType::STATEMENT_DELETE: return "delete " + node->As<AstNodeStatementDelete>()->GetVariableName();
+      case AstNodeType::STATEMENT_CALL: return node->As<AstNodeStatementCall>()->GetFunctionName() + "()";
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        const auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+        switch (modification->GetOperatorType()) {
+          case ModificationOperatorType::ADD: return modification->GetVariableName() + " add";
+          case ModificationOperatorType::SUBTRACT: return modification->GetVariableName() + " sub";
+          case ModificationOperatorType::MULTIPLY: return modification->GetVariableName() + " mult";
+          default: return modification->GetVariableName() + " =";
+        }
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: return node->As<AstNodeStatementFunctionDeclaration>()->GetFunctionName() + " function";
+      case AstNodeType::STATEMENT_CONDITION: return "if";
+      case AstNodeType::STATEMENT_LOOP: return "loop";
+      case AstNodeType::STATEMENT_AFFINE_LOOP: return "loop (closed form)";
+      case AstNodeType::STATEMENT_AFFINE_MODIFICATION: return node->As<AstNodeStatementAffineModification>()->GetTargetName() + " = (affine)";
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: return "check " + node->As<AstNodeStatementCheckFunction>()->GetFunctionName();
+      default: return "?";
+    }
+  }
+
+private:
+  SymbolTable m_functionNames;
+  std::vector<FunctionStats> m_functions;
+  std::unordered_map<const AstNode*, NodeStats> m_nodes;
+  // Folded stack frames, 0 is main and its own parent
+  std::vector<StackFrame> m_stacks;
+  std::unordered_map<StackKey, uint32_t, StackKeyHash> m_stackIndices;
+  std::vector<OpenStatement> m_open;
+};
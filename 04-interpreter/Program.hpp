@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "FunctionCompiler.hpp"
+#include "Interpreter.hpp"
+#include "Lexer.hpp"
+#include "Optimizer.hpp"
+#include "OutputSink.hpp"
+#include "Parser.hpp"
+#include "Resolver.hpp"
+#include "SymbolTable.hpp"
+
+/*
+
+Embedding
+
+  Program program = Compile(source);          once, lexing, parsing, resolving and optimizing happen here
+  Environment environment(program);           per run
+  environment.Set("x", 42);
+  Run(program, environment, output);
+  environment.Get("y");
+
+A Program never changes after Compile, so it's shared by any number of runs on any number of threads.
+An Environment is the state of one run and belongs to one thread at a time, and so does an OutputSink:
+sinks don't lock, runs on different threads need sinks of their own (OutputSink::Standard() is one sink).
+
+*/
+
+struct CompileOptions final {
+  bool optimize = false;
+  // Variables the host seeds or reads that the script may not mention, so they get slots too
+  std::vector<std::string> hostVariables;
+};
+
+struct Program final {
+  [[nodiscard]] const AstNode* GetRoot() const {
+    return m_compiled->root.get();
+  }
+
+  [[nodiscard]] const std::shared_ptr<const SymbolTable>& GetVariables() const {
+    return m_compiled->variables;
+  }
+
+  [[nodiscard]] const std::shared_ptr<const SymbolTable>& GetFunctions() const {
+    return m_compiled->functions;
+  }
+
+  // Null unless compiled with optimize, function bodies are then optimized on their first call
+  [[nodiscard]] FunctionCompiler* GetFunctionCompiler() const {
+    return m_compiled->functionCompiler.get();
+  }
+
+  // SymbolTable::kInvalidSlot if neither the script nor the host variables have it
+  [[nodiscard]] uint32_t FindVariable(std::string_view name) const {
+    return m_compiled->variables->Find(std::string(name));
+  }
+
+private:
+  friend Program Compile(std::string_view source, const CompileOptions& options);
+
+  struct Compiled final {
+    std::shared_ptr<AstNode> root;
+    std::shared_ptr<const SymbolTable> variables;
+    std::shared_ptr<const SymbolTable> functions;
+    std::unique_ptr<FunctionCompiler> functionCompiler;
+  };
+
+  explicit Program(std::shared_ptr<const Compiled> compiled)
+  : m_compiled(std::move(compiled)) {
+  }
+
+private:
+  // Copies of a Program share it
+  std::shared_ptr<const Compiled> m_compiled;
+};
+
+// Throws CompileException if the source doesn't lex or parse
+inline Program Compile(std::string_view source, const CompileOptions& options = {}) {
+  Lexer lexer(source);
+  if (!lexer.Tokenize()) {
+    throw CompileException("Lexing failed.");
+  }
+
+  std::shared_ptr<AstNode> root = Parser(lexer.GetTokens()).Parse();
+  if (!root) {
+    throw CompileException("Parsing failed.");
+  }
+
+  std::optional<Optimizer> optimizer;
+  if (options.optimize) {
+    // Seeded variables make nothing provably undefined, and results are read after the run
+    OptimizerOptions optimizerOptions;
+    optimizerOptions.hasInitialVariables = true;
+    optimizerOptions.keepFinalState = true;
+    optimizerOptions.deferFunctionBodies = true;
+    optimizer.emplace(optimizerOptions);
+    root = optimizer->Optimize(root);
+  }
+
+  Resolver resolver;
+  resolver.Resolve(root.get());
+  SymbolTable variables = resolver.GetVariables();
+  for (const std::string& name : options.hostVariables) {
+    variables.GetOrAdd(name);
+  }
+
+  auto compiled = std::make_shared<Program::Compiled>();
+  compiled->root = std::move(root);
+  compiled->variables = std::make_shared<const SymbolTable>(std::move(variables));
+  compiled->functions = std::make_shared<const SymbolTable>(resolver.GetFunctions());
+  if (optimizer) {
+    compiled->functionCompiler = std::make_unique<FunctionCompiler>(std::move(*optimizer), std::move(resolver));
+  }
+
+  return Program(std::move(compiled));
+}
+
+// Variables of one run of a Program: seeded by the host before Run, read back after it.
+// Names are looked up in the Program's table, hot paths can find the slot once and use it
+struct Environment final {
+  explicit Environment(const Program& program, InterpreterOptions options = {})
+  : m_program(program)
+  , m_interpreter(program.GetVariables(), program.GetFunctions(), options) {
+    m_interpreter.SetFunctionCompiler(program.GetFunctionCompiler());
+  }
+
+  // False if the name has no slot, see CompileOptions::hostVariables
+  bool Set(std::string_view name, int64_t value) {
+    uint32_t slot = m_program.FindVariable(name);
+    if (slot == SymbolTable::kInvalidSlot) {
+      return false;
+    }
+
+    m_interpreter.Define(slot, value);
+    return true;
+  }
+
+  void Set(uint32_t slot, int64_t value) {
+    m_interpreter.Define(slot, value);
+  }
+
+  // Nullopt if the variable isn't defined
+  [[nodiscard]] std::optional<int64_t> Get(std::string_view name) const {
+    return m_interpreter.GetVariable(m_program.FindVariable(name));
+  }
+
+  [[nodiscard]] std::optional<int64_t> Get(uint32_t slot) const {
+    return m_interpreter.GetVariable(slot);
+  }
+
+  // Visits (name, value) in print order, names point into the Program
+  template <typename Func>
+  void ForEach(Func func) const {
+    const SymbolTable& names = *m_program.GetVariables();
+    m_interpreter.ForEachVariable([&names, &func](uint32_t slot, int64_t value) {
+      func(std::string_view(names.GetName(slot)), value);
+    });
+  }
+
+  // Shares the variables until either side writes, to seed a common state once and run variants of it
+  [[nodiscard]] Environment Fork() {
+    return Environment(m_program, m_interpreter.Fork());
+  }
+
+  [[nodiscard]] const Program& GetProgram() const {
+    return m_program;
+  }
+
+private:
+  friend void Run(const Program& program, Environment& environment, OutputSink& output);
+
+  Environment(Program program, Interpreter interpreter)
+  : m_program(std::move(program))
+  , m_interpreter(std::move(interpreter)) {
+  }
+
+private:
+  Program m_program;
+  Interpreter m_interpreter;
+};
+
+// Throws ExecutionException if the script fails and LimitExceededException if it goes over the
+// environment's limits. A second Run of the same environment continues from the state the first one left,
+// print included, so a fresh run takes a fresh (or forked) Environment. Output isn't locked, runs on
+// other threads at the same time need other sinks
+inline void Run(const Program& program, Environment& environment, OutputSink& output) {
+  if (program.GetRoot() != environment.m_program.GetRoot()) {
+    throw std::invalid_argument("Environment belongs to another program.");
+  }
+
+  environment.m_interpreter.SetOutput(output);
+  environment.m_interpreter.Evaluate(program.GetRoot());
+  output.Flush();
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "SymbolTable.hpp"
+
+// Runs once before execution and binds every variable reference, call site and declaration
+// in the tree to a dense slot, so the interpreter never hashes names. Only slots that change are written, so resolving
+// the same tree again (or a new tree sharing nodes with one that is running) is a no-op
+struct Resolver final {
+  void Resolve(AstNode* node) {
+    switch (node->GetType()) {
+      case AstNodeType::VALUE_NUMBER: {
+        return;
+      }
+      case AstNodeType::VALUE_IDENTIFIER: {
+        auto* identifier = node->As<AstNodeValueIdentifier>();
+        uint32_t slot = m_variables.GetOrAdd(identifier->GetName());
+        if (identifier->GetSlot() != slot) {
+          identifier->SetSlot(slot);
+        }
+
+        return;
+      }
+      case AstNodeType::BINARY_OPERATOR: {
+        const auto* opNode = node->As<AstNodeBinaryOperator>();
+        Resolve(opNode->GetLeft().get());
+        Resolve(opNode->GetRight().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_PRINT: {
+        return;
+      }
+      case AstNodeType::STATEMENT_CALL: {
+        auto* call = node->As<AstNodeStatementCall>();
+        uint32_t slot = m_functions.GetOrAdd(call->GetFunctionName());
+        if (call->GetSlot() != slot) {
+          call->SetSlot(slot);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_DELETE: {
+        auto* deletion = node->As<AstNodeStatementDelete>();
+        uint32_t slot = m_variables.GetOrAdd(deletion->GetVariableName());
+        if (deletion->GetSlot() != slot) {
+          deletion->SetSlot(slot);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_VAR_MODIFICATION: {
+        auto* modification = node->As<AstNodeBinaryStatementVarModification>();
+        uint32_t slot = m_variables.GetOrAdd(modification->GetVariableName());
+        if (modification->GetSlot() != slot) {
+          modification->SetSlot(slot);
+        }
+
+        Resolve(modification->GetValue().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_FUNC_DECL: {
+        auto* declaration = node->As<AstNodeStatementFunctionDeclaration>();
+        uint32_t slot = m_functions.GetOrAdd(declaration->GetFunctionName());
+        if (declaration->GetSlot() != slot) {
+          declaration->SetSlot(slot);
+        }
+
+        Resolve(declaration->GetCode().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_CONDITION: {
+        const auto* condition = node->As<AstNodeStatementCondition>();
+        Resolve(condition->GetCondition().get());
+        Resolve(condition->GetCode().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_LOOP: {
+        const auto* loop = node->As<AstNodeStatementLoop>();
+        Resolve(loop->GetInitValue().get());
+        Resolve(loop->GetCode().get());
+        return;
+      }
+      case AstNodeType::STATEMENT_CHAIN: {
+        for (const auto& statement : node->As<AstNodeStatementChain>()->GetStatements()) {
+          Resolve(statement.get());
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_LOOP: {
+        auto* loop = node->As<AstNodeStatementAffineLoop>();
+        Resolve(loop->GetLoop().get());
+        std::vector<uint32_t> slots;
+        for (const auto& name : loop->GetVariableNames()) {
+          slots.emplace_back(m_variables.GetOrAdd(name));
+        }
+
+        if (loop->GetSlots() != slots) {
+          loop->SetSlots(std::move(slots));
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_AFFINE_MODIFICATION: {
+        auto* modification = node->As<AstNodeStatementAffineModification>();
+        uint32_t sourceSlot = modification->HasSource() ? m_variables.GetOrAdd(modification->GetSourceName()) : SymbolTable::kInvalidSlot;
+        uint32_t targetSlot = m_variables.GetOrAdd(modification->GetTargetName());
+        if (modification->GetTargetSlot() != targetSlot || modification->GetSourceSlot() != sourceSlot) {
+          modification->SetSlots(targetSlot, sourceSlot);
+        }
+
+        return;
+      }
+      case AstNodeType::STATEMENT_CHECK_FUNCTION: {
+        auto* check = node->As<AstNodeStatementCheckFunction>();
+        uint32_t slot = m_functions.GetOrAdd(check->GetFunctionName());
+        if (check->GetSlot() != slot) {
+          check->SetSlot(slot);
+        }
+
+        return;
+      }
+      default: throw ExecutionException("Unexpected node.");
+    }
+  }
+
+  [[nodiscard]] const SymbolTable& GetVariables() const {
+    return m_variables;
+  }
+
+  [[nodiscard]] const SymbolTable& GetFunctions() const {
+    return m_functions;
+  }
+
+private:
+  SymbolTable m_variables;
+  SymbolTable m_functions;
+};
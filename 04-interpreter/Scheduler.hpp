@@ -0,0 +1,127 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "Exceptions.hpp"
+#include "Interpreter.hpp"
+#include "Resolver.hpp"
+
+struct SchedulerOptions final {
+  // Steps a task runs before the next one gets its turn
+  uint64_t stepsPerSlice = 10000;
+  // For every task, limits included
+  InterpreterOptions interpreter;
+};
+
+enum struct TaskState : uint8_t {
+  READY,
+  FINISHED,
+  FAILED,
+  LIMIT_EXCEEDED,
+  CANCELLED
+};
+
+struct TaskProgress final {
+  TaskState state;
+  uint64_t stepCount;
+  size_t stackDepth;
+  // Set if the task failed or exceeded a limit
+  std::string error;
+};
+
+// Round-robins any number of scripts on the calling thread. Every script is a resumable
+// Interpreter that runs one slice of steps per turn, so a long loop only delays the others
+// by a slice per round instead of blocking them
+struct Scheduler final {
+  using TaskId = size_t;
+
+  explicit Scheduler(SchedulerOptions options = {})
+  : m_options(options) {
+  }
+
+  TaskId Add(std::shared_ptr<AstNode> program) {
+    Resolver resolver;
+    resolver.Resolve(program.get());
+    TaskId id = m_tasks.size();
+    auto& task = m_tasks.emplace_back(std::make_unique<Task>(std::move(program), resolver, m_options.interpreter));
+    task->interpreter.Start(task->program.get());
+    m_ready.emplace_back(id);
+    return id;
+  }
+
+  void Cancel(TaskId id) {
+    Task& task = *m_tasks.at(id);
+    if (task.state == TaskState::READY) {
+      task.state = TaskState::CANCELLED;
+      task.interpreter.Cancel();
+    }
+  }
+
+  [[nodiscard]] TaskProgress GetProgress(TaskId id) const {
+    const Task& task = *m_tasks.at(id);
+    return TaskProgress(task.state, task.interpreter.GetStepCount(), task.interpreter.GetStackDepth(), task.error);
+  }
+
+  [[nodiscard]] size_t GetTaskCount() const {
+    return m_tasks.size();
+  }
+
+  // Gives the next ready task one slice. Returns false once nothing is left to run
+  bool RunSlice() {
+    while (!m_ready.empty()) {
+      TaskId id = m_ready.front();
+      m_ready.pop_front();
+      Task& task = *m_tasks[id];
+      if (task.state != TaskState::READY) {
+        continue;
+      }
+
+      try {
+        if (task.interpreter.Resume(m_options.stepsPerSlice)) {
+          task.state = TaskState::FINISHED;
+        } else {
+          m_ready.emplace_back(id);
+        }
+      } catch (ExecutionException& e) {
+        task.state = TaskState::FAILED;
+        task.error = e.what();
+      } catch (LimitExceededException& e) {
+        task.state = TaskState::LIMIT_EXCEEDED;
+        task.error = e.what();
+      }
+
+      return true;
+    }
+
+    return false;
+  }
+
+  void RunAll() {
+    while (RunSlice()) {
+    }
+  }
+
+private:
+  struct Task final {
+    Task(std::shared_ptr<AstNode> program, const Resolver& resolver, const InterpreterOptions& options)
+    : program(std::move(program))
+    , interpreter(resolver.GetVariables(), resolver.GetFunctions(), options) {
+    }
+
+    std::shared_ptr<AstNode> program;
+    Interpreter interpreter;
+    TaskState state = TaskState::READY;
+    std::string error;
+  };
+
+private:
+  SchedulerOptions m_options;
+  std::vector<std::unique_ptr<Task>> m_tasks;
+  // Round-robin order, finished and cancelled tasks are dropped when they come up
+  std::deque<TaskId> m_ready;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SourcePosition.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SNAPSHOT_MMAP 1
+#else
+#define SNAPSHOT_MMAP 0
+#endif
+
+/*
+
+Snapshot file
+
+The state of an Interpreter after a run, so a later run can start from it instead of running the same
+prologue again. Everything is fixed size and 8-byte aligned, so the file is used in place once mapped:
+
+  SnapshotHeader
+  SnapshotVariable[variableCount]  in print order
+  SnapshotFunction[functionCount]  bound functions only
+  names                            referenced by offset and size
+  source                           of the program that ran
+
+Functions refer to their declaration by name and source position. The source is kept in the snapshot,
+so whoever restores it parses the same program again (parsing is cheap, running it is what's skipped)
+and the declaration with that position is the one that was bound.
+
+*/
+
+struct SnapshotHeader final {
+  static constexpr char kMagic[8] = {'S', 'N', 'A', 'P', 'S', 'H', 'O', 'T'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t isTerminated;
+  uint32_t variableCount;
+  uint32_t functionCount;
+  uint64_t namesSize;
+  uint64_t sourceSize;
+};
+
+struct SnapshotVariable final {
+  uint32_t nameOffset;
+  uint32_t nameSize;
+  int64_t value;
+};
+
+struct SnapshotFunction final {
+  uint32_t nameOffset;
+  uint32_t nameSize;
+  SourcePosition declaration;
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotVariable) % 8 == 0 && sizeof(SnapshotFunction) % 8 == 0);
+
+struct SnapshotWriter final {
+  explicit SnapshotWriter(std::string source)
+  : m_source(std::move(source)) {
+  }
+
+  void SetTerminated(bool isTerminated) {
+    m_isTerminated = isTerminated;
+  }
+
+  void AddVariable(std::string_view name, int64_t value) {
+    m_variables.emplace_back(AddName(name), static_cast<uint32_t>(name.size()), value);
+  }
+
+  void AddFunction(std::string_view name, SourcePosition declaration) {
+    m_functions.emplace_back(AddName(name), static_cast<uint32_t>(name.size()), declaration);
+  }
+
+  bool Write(const std::string& path) const {
+    SnapshotHeader header;
+    std::memcpy(header.magic, SnapshotHeader::kMagic, sizeof(header.magic));
+    header.version = SnapshotHeader::kVersion;
+    header.isTerminated = m_isTerminated ? 1 : 0;
+    header.variableCount = static_cast<uint32_t>(m_variables.size());
+    header.functionCount = static_cast<uint32_t>(m_functions.size());
+    header.namesSize = m_names.size();
+    header.sourceSize = m_source.size();
+
+    std::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(m_variables.data()), static_cast<std::streamsize>(m_variables.size() * sizeof(SnapshotVariable)));
+    output.write(reinterpret_cast<const char*>(m_functions.data()), static_cast<std::streamsize>(m_functions.size() * sizeof(SnapshotFunction)));
+    output.write(m_names.data(), static_cast<std::streamsize>(m_names.size()));
+    output.write(m_source.data(), static_cast<std::streamsize>(m_source.size()));
+    return static_cast<bool>(output);
+  }
+
+private:
+  uint32_t AddName(std::string_view name) {
+    auto offset = static_cast<uint32_t>(m_names.size());
+    m_names.append(name);
+    return offset;
+  }
+
+private:
+  std::string m_source;
+  bool m_isTerminated = false;
+  std::vector<SnapshotVariable> m_variables;
+  std::vector<SnapshotFunction> m_functions;
+  std::string m_names;
+};
+
+// A snapshot mapped read-only, or read into memory where mmap isn't available
+struct SnapshotFile final {
+  // Null if the file can't be read or isn't a valid snapshot
+  static std::unique_ptr<SnapshotFile> Open(const std::string& path) {
+    std::unique_ptr<SnapshotFile> file(new SnapshotFile());
+    if (!file->Load(path) || !file->Validate()) {
+      return nullptr;
+    }
+
+    return file;
+  }
+
+  SnapshotFile(const SnapshotFile&) = delete;
+  SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+  ~SnapshotFile() {
+#if SNAPSHOT_MMAP
+    if (m_mapping) {
+      munmap(m_mapping, m_size);
+    }
+#endif
+  }
+
+  [[nodiscard]] bool IsTerminated() const {
+    return GetHeader().isTerminated != 0;
+  }
+
+  [[nodiscard]] const SnapshotVariable* GetVariables() const {
+    return reinterpret_cast<const SnapshotVariable*>(m_data + sizeof(SnapshotHeader));
+  }
+
+  [[nodiscard]] size_t GetVariableCount() const {
+    return GetHeader().variableCount;
+  }
+
+  [[nodiscard]] const SnapshotFunction* GetFunctions() const {
+    return reinterpret_cast<const SnapshotFunction*>(GetVariables() + GetVariableCount());
+  }
+
+  [[nodiscard]] size_t GetFunctionCount() const {
+    return GetHeader().functionCount;
+  }
+
+  [[nodiscard]] std::string_view GetName(uint32_t offset, uint32_t size) const {
+    return std::string_view(GetNames() + offset, size);
+  }
+
+  [[nodiscard]] std::string_view GetSource() const {
+    return std::string_view(GetNames() + GetHeader().namesSize, GetHeader().sourceSize);
+  }
+
+private:
+  SnapshotFile() = default;
+
+  [[nodiscard]] const SnapshotHeader& GetHeader() const {
+    return *reinterpret_cast<const SnapshotHeader*>(m_data);
+  }
+
+  [[nodiscard]] const char* GetNames() const {
+    return reinterpret_cast<const char*>(GetFunctions() + GetFunctionCount());
+  }
+
+  bool Load(const std::string& path) {
+#if SNAPSHOT_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+      close(fd);
+      return false;
+    }
+
+    m_size = static_cast<size_t>(status.st_size);
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+
+    m_mapping = mapping;
+    m_data = static_cast<const char*>(mapping);
+    return true;
+#else
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    if (!input) {
+      return false;
+    }
+
+    m_size = static_cast<size_t>(input.tellg());
+    // uint64_t keeps the entries aligned
+    m_buffer.resize((m_size + 7) / 8);
+    input.seekg(0);
+    input.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(m_size));
+    m_data = reinterpret_cast<const char*>(m_buffer.data());
+    return static_cast<bool>(input);
+#endif
+  }
+
+  [[nodiscard]] bool Validate() const {
+    if (m_size < sizeof(SnapshotHeader)) {
+      return false;
+    }
+
+    const SnapshotHeader& header = GetHeader();
+    if (std::memcmp(header.magic, SnapshotHeader::kMagic, sizeof(header.magic)) != 0 || header.version != SnapshotHeader::kVersion) {
+      return false;
+    }
+
+    uint64_t expectedSize = sizeof(SnapshotHeader)
+      + uint64_t(header.variableCount) * sizeof(SnapshotVariable)
+      + uint64_t(header.functionCount) * sizeof(SnapshotFunction);
+    if (header.namesSize > m_size || header.sourceSize > m_size || expectedSize + header.namesSize + header.sourceSize != m_size) {
+      return false;
+    }
+
+    for (size_t i = 0; i < GetVariableCount(); ++i) {
+      if (uint64_t(GetVariables()[i].nameOffset) + GetVariables()[i].nameSize > header.namesSize) {
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < GetFunctionCount(); ++i) {
+      if (uint64_t(GetFunctions()[i].nameOffset) + GetFunctions()[i].nameSize > header.namesSize) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+#if SNAPSHOT_MMAP
+  void* m_mapping = nullptr;
+#else
+  std::vector<uint64_t> m_buffer;
+#endif
+};
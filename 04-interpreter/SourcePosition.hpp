@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Where a token or a statement starts, 1-based. Zero for nodes that the optimizer made up
+struct SourcePosition final {
+  uint32_t line = 0;
+  uint32_t column = 0;
+};
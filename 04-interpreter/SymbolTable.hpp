@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Maps identifiers to dense indices. Names are only hashed while compiling,
+// at runtime everything is addressed by slot
+struct SymbolTable final {
+  static constexpr uint32_t kInvalidSlot = UINT32_MAX;
+
+  uint32_t GetOrAdd(const std::string& name) {
+    if (auto iter = m_slots.find(name); iter != m_slots.end()) {
+      return iter->second;
+    }
+
+    auto slot = static_cast<uint32_t>(m_names.size());
+    m_names.emplace_back(name);
+    m_slots.emplace(name, slot);
+    return slot;
+  }
+
+  [[nodiscard]] uint32_t Find(const std::string& name) const {
+    auto iter = m_slots.find(name);
+    return iter == m_slots.end() ? kInvalidSlot : iter->second;
+  }
+
+  [[nodiscard]] const std::string& GetName(uint32_t slot) const {
+    return m_names.at(slot);
+  }
+
+  [[nodiscard]] size_t GetSize() const {
+    return m_names.size();
+  }
+
+private:
+  std::vector<std::string> m_names;
+  std::unordered_map<std::string, uint32_t> m_slots;
+};
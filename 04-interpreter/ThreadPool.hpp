@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of workers taking tasks in submission order. Tasks must not throw,
+// whatever they produce is for them to store somewhere
+struct ThreadPool final {
+  explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency()) {
+    threadCount = std::max<size_t>(threadCount, 1);
+    for (size_t i = 0; i < threadCount; ++i) {
+      m_threads.emplace_back([this] { Work(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs whatever was submitted, then stops the workers
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(m_mutex);
+      m_isStopping = true;
+    }
+
+    m_hasTasks.notify_all();
+    for (std::thread& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard lock(m_mutex);
+      m_tasks.emplace_back(std::move(task));
+      ++m_pendingCount;
+    }
+
+    m_hasTasks.notify_one();
+  }
+
+  // Until every submitted task has finished
+  void Wait() {
+    std::unique_lock lock(m_mutex);
+    m_isIdle.wait(lock, [this] { return m_pendingCount == 0; });
+  }
+
+  [[nodiscard]] size_t GetThreadCount() const {
+    return m_threads.size();
+  }
+
+private:
+  void Work() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(m_mutex);
+        m_hasTasks.wait(lock, [this] { return m_isStopping || !m_tasks.empty(); });
+        if (m_tasks.empty()) {
+          return;
+        }
+
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+
+      task();
+      std::lock_guard lock(m_mutex);
+      if (--m_pendingCount == 0) {
+        m_isIdle.notify_all();
+      }
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_hasTasks;
+  std::condition_variable m_isIdle;
+  std::deque<std::function<void()>> m_tasks;
+  size_t m_pendingCount = 0;
+  bool m_isStopping = false;
+  std::vector<std::thread> m_threads;
+};
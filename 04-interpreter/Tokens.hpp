@@ -3,6 +3,7 @@
 #include <string>
 
 #include "Grammar.hpp"
+#include "SourcePosition.hpp"
 
 struct Token;
 
@@ -31,6 +32,14 @@ struct Token {
     return dynamic_cast<const T*>(this);
   }
 
+  [[nodiscard]] SourcePosition GetSourcePosition() const {
+    return m_position;
+  }
+
+  void SetSourcePosition(SourcePosition position) {
+    m_position = position;
+  }
+
 protected:
   explicit Token(TokenType type)
   : m_type(type) {
@@ -38,6 +47,7 @@ protected:
 
 private:
   TokenType m_type;
+  SourcePosition m_position;
 };
 
 template <TokenType T>
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "Tracer.hpp"
+
+// Prints a trace written by Parsing --trace, oldest record first:
+//
+//   3:5 declare a = 1
+//   4:1 a 1 -> 3
+//   5:1 call f
+//   6:1 delete a = 3
+
+void PrintName(std::string_view name, uint32_t slot) {
+  if (name.empty()) {
+    std::cout << '#' << slot;
+  } else {
+    std::cout << name;
+  }
+}
+
+void PrintRecord(const TraceFile& trace, const TraceRecord& record) {
+  // Statements the optimizer made up have no position
+  if (record.position.line == 0) {
+    std::cout << "?:? ";
+  } else {
+    std::cout << record.position.line << ':' << record.position.column << ' ';
+  }
+
+  switch (record.event) {
+    case TraceEvent::DECLARE: {
+      std::cout << "declare ";
+      PrintName(trace.GetVariableName(record.slot), record.slot);
+      std::cout << " = " << record.newValue << '\n';
+      return;
+    }
+    case TraceEvent::WRITE: {
+      PrintName(trace.GetVariableName(record.slot), record.slot);
+      std::cout << ' ' << record.oldValue << " -> " << record.newValue << '\n';
+      return;
+    }
+    case TraceEvent::DELETE: {
+      std::cout << "delete ";
+      PrintName(trace.GetVariableName(record.slot), record.slot);
+      std::cout << " = " << record.oldValue << '\n';
+      return;
+    }
+    case TraceEvent::CALL: {
+      std::cout << "call ";
+      PrintName(trace.GetFunctionName(record.slot), record.slot);
+      std::cout << '\n';
+      return;
+    }
+    default: return;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: TraceDecoder TRACE_FILE\n";
+    return 1;
+  }
+
+  std::unique_ptr<TraceFile> trace = TraceFile::Open(argv[1]);
+  if (!trace) {
+    std::cerr << "Can't read " << argv[1] << '\n';
+    return 1;
+  }
+
+  uint64_t overwritten = trace->GetTotalCount() - trace->GetRecordCount();
+  if (overwritten > 0) {
+    std::cout << "... " << overwritten << " earlier records overwritten\n";
+  }
+
+  for (size_t i = 0; i < trace->GetRecordCount(); ++i) {
+    PrintRecord(*trace, trace->GetRecords()[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AstNodes.hpp"
+#include "SourcePosition.hpp"
+#include "SymbolTable.hpp"
+
+/*
+
+Execution trace
+
+An interpreter with TracerHooks reports every variable write, delete and call, the tracer keeps the latest
+ones in a ring buffer of fixed-size records. Appending is a store and an increment, so tracing can stay on
+in production and the buffer is written out when something goes wrong (or whenever asked).
+
+Trace file, fixed size and 8-byte aligned like snapshots:
+
+  TraceHeader
+  TraceRecord[recordCount]  oldest first
+  names                     variables then functions, by slot, each followed by '\n'
+
+Records refer to statements by source position and to variables and functions by slot,
+the names make the file readable without the program (see TraceDecoder.cpp).
+
+*/
+
+enum struct TraceEvent : uint32_t {
+  // slot was undefined, newValue is its first value
+  DECLARE,
+  // oldValue -> newValue
+  WRITE,
+  // oldValue is the last value
+  DELETE,
+  // slot is a function slot
+  CALL,
+
+  COUNT
+};
+
+struct TraceRecord final {
+  SourcePosition position;
+  TraceEvent event;
+  uint32_t slot;
+  int64_t oldValue;
+  int64_t newValue;
+};
+
+struct TraceHeader final {
+  static constexpr char kMagic[8] = {'T', 'R', 'A', 'C', 'E', 'L', 'O', 'G'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  // In the file, and since tracing started, the difference was overwritten
+  uint64_t recordCount;
+  uint64_t totalCount;
+  uint32_t variableCount;
+  uint32_t functionCount;
+  uint64_t namesSize;
+};
+
+static_assert(sizeof(TraceHeader) % 8 == 0 && sizeof(TraceRecord) % 8 == 0);
+
+struct Tracer final {
+  static constexpr size_t kDefaultCapacity = size_t(1) << 16;
+
+  // Capacity is rounded up to a power of two
+  explicit Tracer(const SymbolTable& variables, const SymbolTable& functions, size_t capacity = kDefaultCapacity)
+  : m_variableNames(variables)
+  , m_functionNames(functions)
+  , m_records(std::bit_ceil(std::max<size_t>(capacity, 1)))
+  , m_mask(m_records.size() - 1) {
+  }
+
+  void Record(const AstNode* node, TraceEvent event, uint32_t slot, int64_t oldValue, int64_t newValue) {
+    m_records[m_count++ & m_mask] = TraceRecord(node->GetSourcePosition(), event, slot, oldValue, newValue);
+  }
+
+  // Everything recorded so far, the ring buffer overwrites the oldest records once full
+  [[nodiscard]] uint64_t GetTotalCount() const {
+    return m_count;
+  }
+
+  // Visits the records still in the buffer, oldest first
+  template <typename Func>
+  void ForEach(Func func) const {
+    uint64_t first = m_count > m_records.size() ? m_count - m_records.size() : 0;
+    for (uint64_t i = first; i < m_count; ++i) {
+      func(m_records[i & m_mask]);
+    }
+  }
+
+  // Doesn't clear the buffer, so it can be written again later
+  bool Write(const std::string& path) const {
+    std::string names;
+    for (uint32_t slot = 0; slot < m_variableNames.GetSize(); ++slot) {
+      names.append(m_variableNames.GetName(slot)).push_back('\n');
+    }
+
+    for (uint32_t slot = 0; slot < m_functionNames.GetSize(); ++slot) {
+      names.append(m_functionNames.GetName(slot)).push_back('\n');
+    }
+
+    // Names are padded with newlines to keep the file 8-byte aligned
+    names.resize((names.size() + 7) / 8 * 8, '\n');
+
+    TraceHeader header;
+    std::memcpy(header.magic, TraceHeader::kMagic, sizeof(header.magic));
+    header.version = TraceHeader::kVersion;
+    header.recordSize = sizeof(TraceRecord);
+    header.recordCount = std::min<uint64_t>(m_count, m_records.size());
+    header.totalCount = m_count;
+    header.variableCount = static_cast<uint32_t>(m_variableNames.GetSize());
+    header.functionCount = static_cast<uint32_t>(m_functionNames.GetSize());
+    header.namesSize = names.size();
+
+    std::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ForEach([&output](const TraceRecord& record) {
+      output.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    });
+    output.write(names.data(), static_cast<std::streamsize>(names.size()));
+    return static_cast<bool>(output);
+  }
+
+private:
+  SymbolTable m_variableNames;
+  SymbolTable m_functionNames;
+  std::vector<TraceRecord> m_records;
+  size_t m_mask;
+  uint64_t m_count = 0;
+};
+
+// A trace file read into memory
+struct TraceFile final {
+  // Null if the file can't be read or isn't a valid trace
+  static std::unique_ptr<TraceFile> Open(const std::string& path) {
+    std::unique_ptr<TraceFile> file(new TraceFile());
+    if (!file->Load(path) || !file->Validate()) {
+      return nullptr;
+    }
+
+    return file;
+  }
+
+  [[nodiscard]] const TraceRecord* GetRecords() const {
+    return reinterpret_cast<const TraceRecord*>(GetData() + sizeof(TraceHeader));
+  }
+
+  [[nodiscard]] size_t GetRecordCount() const {
+    return GetHeader().recordCount;
+  }
+
+  [[nodiscard]] uint64_t GetTotalCount() const {
+    return GetHeader().totalCount;
+  }
+
+  // Empty if there is no such slot
+  [[nodiscard]] std::string_view GetVariableName(uint32_t slot) const {
+    return slot < m_variableNames.size() ? m_variableNames[slot] : std::string_view();
+  }
+
+  [[nodiscard]] std::string_view GetFunctionName(uint32_t slot) const {
+    return slot < m_functionNames.size() ? m_functionNames[slot] : std::string_view();
+  }
+
+private:
+  TraceFile() = default;
+
+  [[nodiscard]] const char* GetData() const {
+    return reinterpret_cast<const char*>(m_buffer.data());
+  }
+
+  [[nodiscard]] const TraceHeader& GetHeader() const {
+    return *reinterpret_cast<const TraceHeader*>(GetData());
+  }
+
+  bool Load(const std::string& path) {
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    if (!input) {
+      return false;
+    }
+
+    m_size = static_cast<size_t>(input.tellg());
+    // uint64_t keeps the records aligned
+    m_buffer.resize((m_size + 7) / 8);
+    input.seekg(0);
+    input.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(m_size));
+    return static_cast<bool>(input);
+  }
+
+  bool Validate() {
+    if (m_size < sizeof(TraceHeader)) {
+      return false;
+    }
+
+    const TraceHeader& header = GetHeader();
+    if (std::memcmp(header.magic, TraceHeader::kMagic, sizeof(header.magic)) != 0 || header.version != TraceHeader::kVersion
+    || header.recordSize != sizeof(TraceRecord)) {
+      return false;
+    }
+
+    if (header.recordCount > m_size / sizeof(TraceRecord) || header.namesSize > m_size
+    || sizeof(TraceHeader) + header.recordCount * sizeof(TraceRecord) + header.namesSize != m_size) {
+      return false;
+    }
+
+    std::string_view names(reinterpret_cast<const char*>(GetRecords() + header.recordCount), header.namesSize);
+    for (size_t i = 0; i < uint64_t(header.variableCount) + header.functionCount; ++i) {
+      size_t end = names.find('\n');
+      if (end == std::string_view::npos) {
+        return false;
+      }
+
+      (i < header.variableCount ? m_variableNames : m_functionNames).emplace_back(names.substr(0, end));
+      names.remove_prefix(end + 1);
+    }
+
+    for (size_t i = 0; i < header.recordCount; ++i) {
+      if (GetRecords()[i].event >= TraceEvent::COUNT) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  std::vector<uint64_t> m_buffer;
+  size_t m_size = 0;
+  std::vector<std::string_view> m_variableNames;
+  std::vector<std::string_view> m_functionNames;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Slot-addressed variables. Print should print variables in declaration order,
+// so defined slots are additionally threaded into an intrusive list
+struct VariableStorage final {
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  void Resize(size_t slotCount) {
+    m_values.resize(slotCount, 0);
+    m_isDefined.resize(slotCount, false);
+    m_links.resize(slotCount, Link(kNone, kNone));
+  }
+
+  void Clear() {
+    std::fill(m_isDefined.begin(), m_isDefined.end(), false);
+    m_head = kNone;
+    m_tail = kNone;
+    m_count = 0;
+  }
+
+  [[nodiscard]] size_t GetSlotCount() const {
+    return m_values.size();
+  }
+
+  [[nodiscard]] size_t GetDefinedCount() const {
+    return m_count;
+  }
+
+  [[nodiscard]] bool IsDefined(uint32_t slot) const {
+    assert(slot < m_isDefined.size());
+    return m_isDefined[slot];
+  }
+
+  [[nodiscard]] int64_t Get(uint32_t slot) const {
+    assert(IsDefined(slot));
+    return m_values[slot];
+  }
+
+  [[nodiscard]] int64_t& At(uint32_t slot) {
+    assert(IsDefined(slot));
+    return m_values[slot];
+  }
+
+  // Reassigns a defined slot or declares it at the end of the print order
+  void Set(uint32_t slot, int64_t value) {
+    if (!IsDefined(slot)) {
+      Define(slot);
+    }
+
+    m_values[slot] = value;
+  }
+
+  void Erase(uint32_t slot) {
+    assert(IsDefined(slot));
+    const Link& link = m_links[slot];
+    (link.prev == kNone ? m_head : m_links[link.prev].next) = link.next;
+    (link.next == kNone ? m_tail : m_links[link.next].prev) = link.prev;
+    m_isDefined[slot] = false;
+    --m_count;
+  }
+
+  // Visits (slot, value) in declaration order
+  template <typename Func>
+  void ForEach(Func func) const {
+    for (uint32_t slot = m_head; slot != kNone; slot = m_links[slot].next) {
+      func(slot, m_values[slot]);
+    }
+  }
+
+  [[nodiscard]] int64_t* GetValues() {
+    return m_values.data();
+  }
+
+private:
+  struct Link final {
+    uint32_t prev;
+    uint32_t next;
+  };
+
+  void Define(uint32_t slot) {
+    m_links[slot] = Link(m_tail, kNone);
+    (m_tail == kNone ? m_head : m_links[m_tail].next) = slot;
+    m_tail = slot;
+    m_isDefined[slot] = true;
+    ++m_count;
+  }
+
+private:
+  std::vector<int64_t> m_values;
+  std::vector<uint8_t> m_isDefined;
+  std::vector<Link> m_links;
+  uint32_t m_head = kNone;
+  uint32_t m_tail = kNone;
+  size_t m_count = 0;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Arithmetic.hpp"
+#include "Bytecode.hpp"
+#include "Exceptions.hpp"
+#include "Jit.hpp"
+#include "OutputSink.hpp"
+#include "VariableStorage.hpp"
+
+// Executes BytecodeProgram. Observable behaviour (output, errors, print order) matches Interpreter
+struct VirtualMachine final {
+  static constexpr uint32_t kUnbound = kUnboundFunction;
+
+  explicit VirtualMachine(const BytecodeProgram& program)
+  : m_program(program)
+  , m_output(&OutputSink::Standard()) {
+    m_variables.Resize(program.variables.GetSize());
+    m_functions.resize(program.functions.GetSize(), kUnbound);
+  }
+
+  void Reset() {
+    m_shouldTerminate = false;
+  }
+
+  // Print writes there, the sink has to outlive the VirtualMachine
+  void SetOutput(OutputSink& output) {
+    m_output = &output;
+  }
+
+  // Hot loops and functions are then compiled to native code. Returns false if the platform has no JIT
+  bool EnableJit(JitOptions options = {}) {
+    if (!Jit::kIsSupported) {
+      return false;
+    }
+
+    m_jit = std::make_unique<Jit>(m_program, options);
+    return true;
+  }
+
+  void Run() noexcept(false) {
+    if (m_shouldTerminate) {
+      return;
+    }
+
+    m_callStack.clear();
+    m_loopCounters.clear();
+    Execute();
+  }
+
+private:
+  int64_t Load(uint32_t slot) const {
+    if (!m_variables.IsDefined(slot)) {
+      throw ExecutionException("Undefined variable.");
+    }
+
+    return m_variables.Get(slot);
+  }
+
+  int64_t& Reference(uint32_t slot) {
+    if (!m_variables.IsDefined(slot)) {
+      throw ExecutionException("Undefined variable.");
+    }
+
+    return m_variables.At(slot);
+  }
+
+  void Print() {
+    m_shouldTerminate = true;
+    m_variables.ForEach([this](uint32_t slot, int64_t value) {
+      m_output->WriteVariable(m_program.variables.GetName(slot), value);
+    });
+    m_output->Flush();
+  }
+
+  void Execute() {
+    const Instruction* code = m_program.code.data();
+    uint32_t pc = 0;
+    while (true) {
+      const Instruction& instruction = code[pc++];
+      switch (instruction.opCode) {
+        case OpCode::ASSIGN_CONST: {
+          m_variables.Set(instruction.slot, instruction.immediate);
+          break;
+        }
+        case OpCode::ASSIGN_VAR: {
+          m_variables.Set(instruction.slot, Load(instruction.operand));
+          break;
+        }
+        case OpCode::ADD_CONST: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingAdd(value, instruction.immediate);
+          break;
+        }
+        case OpCode::ADD_VAR: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingAdd(value, Load(instruction.operand));
+          break;
+        }
+        case OpCode::SUB_CONST: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingSubtract(value, instruction.immediate);
+          break;
+        }
+        case OpCode::SUB_VAR: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingSubtract(value, Load(instruction.operand));
+          break;
+        }
+        case OpCode::MULT_CONST: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingMultiply(value, instruction.immediate);
+          break;
+        }
+        case OpCode::MULT_VAR: {
+          int64_t& value = Reference(instruction.slot);
+          value = WrappingMultiply(value, Load(instruction.operand));
+          break;
+        }
+        case OpCode::DELETE: {
+          if (!m_variables.IsDefined(instruction.slot)) {
+            throw ExecutionException("Undefined variable.");
+          }
+
+          m_variables.Erase(instruction.slot);
+          break;
+        }
+        case OpCode::JUMP: {
+          pc = instruction.target;
+          break;
+        }
+        case OpCode::JUMP_IF_EQUAL_CONST: {
+          if (Load(instruction.slot) == instruction.immediate) {
+            pc = instruction.target;
+          }
+
+          break;
+        }
+        case OpCode::JUMP_IF_EQUAL_VAR: {
+          if (Load(instruction.slot) == Load(instruction.operand)) {
+            pc = instruction.target;
+          }
+
+          break;
+        }
+        case OpCode::JUMP_IF_NOT_EQUAL_CONST: {
+          if (Load(instruction.slot) != instruction.immediate) {
+            pc = instruction.target;
+          }
+
+          break;
+        }
+        case OpCode::JUMP_IF_NOT_EQUAL_VAR: {
+          if (Load(instruction.slot) != Load(instruction.operand)) {
+            pc = instruction.target;
+          }
+
+          break;
+        }
+        case OpCode::LOOP_BEGIN_CONST: {
+          if (instruction.immediate <= 0) {
+            pc = instruction.target;
+            break;
+          }
+
+          if (m_jit && m_jit->TryExecuteLoop(pc - 1, instruction.immediate, m_variables, m_functions)) {
+            pc = instruction.target;
+            break;
+          }
+
+          m_loopCounters.emplace_back(instruction.immediate);
+          break;
+        }
+        case OpCode::LOOP_BEGIN_VAR: {
+          int64_t count = Load(instruction.slot);
+          if (count <= 0) {
+            pc = instruction.target;
+            break;
+          }
+
+          if (m_jit && m_jit->TryExecuteLoop(pc - 1, count, m_variables, m_functions)) {
+            pc = instruction.target;
+            break;
+          }
+
+          m_loopCounters.emplace_back(count);
+          break;
+        }
+        case OpCode::LOOP_NEXT: {
+          if (--m_loopCounters.back() > 0) {
+            pc = instruction.target;
+            break;
+          }
+
+          m_loopCounters.pop_back();
+          break;
+        }
+        case OpCode::DECLARE_FUNCTION: {
+          if (m_functions[instruction.slot] != kUnbound) {
+            throw ExecutionException("Function is already defined.");
+          }
+
+          m_functions[instruction.slot] = instruction.target;
+          break;
+        }
+        case OpCode::CALL: {
+          uint32_t entry = m_functions[instruction.slot];
+          if (entry == kUnbound) {
+            throw ExecutionException("Undefined function.");
+          }
+
+          if (m_jit && m_jit->TryExecuteFunction(entry, m_variables, m_functions)) {
+            break;
+          }
+
+          m_callStack.emplace_back(pc);
+          pc = entry;
+          break;
+        }
+        case OpCode::CHECK_FUNCTION: {
+          if (m_functions[instruction.slot] == kUnbound) {
+            throw ExecutionException("Undefined function.");
+          }
+
+          break;
+        }
+        case OpCode::RETURN: {
+          pc = m_callStack.back();
+          m_callStack.pop_back();
+          break;
+        }
+        case OpCode::PRINT: {
+          // Print terminates the whole program, including all pending loops and calls
+          Print();
+          return;
+        }
+        case OpCode::HALT: {
+          return;
+        }
+        default: throw ExecutionException("Unexpected instruction.");
+      }
+    }
+  }
+
+private:
+  const BytecodeProgram& m_program;
+  OutputSink* m_output;
+  bool m_shouldTerminate = false;
+  VariableStorage m_variables;
+  // Function slot -> body entry
+  std::vector<uint32_t> m_functions;
+  std::vector<uint32_t> m_callStack;
+  std::vector<int64_t> m_loopCounters;
+  std::unique_ptr<Jit> m_jit;
+};
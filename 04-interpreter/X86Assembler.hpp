@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
+
+/*
+
+Minimal x86-64 encoder for what Jit needs: 64-bit moves, add/sub/imul/cmp,
+push/pop, and rel32 jumps with late patching.
+
+Operands are either a register or [base + disp32].
+
+*/
+
+enum struct Register : uint8_t {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum struct Condition : uint8_t {
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+  LESS_EQUAL = 0xE,
+  GREATER = 0xF
+};
+
+struct Location final {
+  static Location InRegister(Register reg) {
+    return Location(true, reg, Register::RAX, 0);
+  }
+
+  static Location InMemory(Register base, int32_t displacement) {
+    return Location(false, Register::RAX, base, displacement);
+  }
+
+  bool operator==(const Location& other) const = default;
+
+  bool isRegister;
+  Register reg;
+  Register base;
+  int32_t displacement;
+};
+
+struct X86Assembler final {
+  [[nodiscard]] const std::vector<uint8_t>& GetCode() const {
+    return m_code;
+  }
+
+  [[nodiscard]] size_t GetPosition() const {
+    return m_code.size();
+  }
+
+  static bool FitsInt32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+  }
+
+  void MovRegisterImmediate(Register reg, int64_t value) {
+    if (FitsInt32(value)) {
+      MovImmediate(Location::InRegister(reg), static_cast<int32_t>(value));
+      return;
+    }
+
+    EmitRex(true, 0, Index(reg));
+    EmitByte(0xB8 + (Index(reg) & 7));
+    EmitImmediate64(value);
+  }
+
+  // mov r/m64, imm32 (sign-extended)
+  void MovImmediate(const Location& destination, int32_t value) {
+    EmitOperation({ 0xC7 }, 0, destination);
+    EmitImmediate32(value);
+  }
+
+  void Mov(const Location& destination, Register source) {
+    if (destination.isRegister && destination.reg == source) {
+      return;
+    }
+
+    EmitOperation({ 0x89 }, Index(source), destination);
+  }
+
+  void Mov(Register destination, const Location& source) {
+    if (source.isRegister && source.reg == destination) {
+      return;
+    }
+
+    EmitOperation({ 0x8B }, Index(destination), source);
+  }
+
+  void Add(const Location& destination, Register source) {
+    EmitOperation({ 0x01 }, Index(source), destination);
+  }
+
+  void Add(const Location& destination, int32_t value) {
+    EmitOperation({ 0x81 }, 0, destination);
+    EmitImmediate32(value);
+  }
+
+  void Sub(const Location& destination, Register source) {
+    EmitOperation({ 0x29 }, Index(source), destination);
+  }
+
+  void Sub(const Location& destination, int32_t value) {
+    EmitOperation({ 0x81 }, 5, destination);
+    EmitImmediate32(value);
+  }
+
+  void Cmp(const Location& left, Register right) {
+    EmitOperation({ 0x39 }, Index(right), left);
+  }
+
+  void Cmp(const Location& left, int32_t value) {
+    EmitOperation({ 0x81 }, 7, left);
+    EmitImmediate32(value);
+  }
+
+  // destination *= source
+  void Imul(Register destination, const Location& source) {
+    EmitOperation({ 0x0F, 0xAF }, Index(destination), source);
+  }
+
+  // destination = source * value
+  void Imul(Register destination, const Location& source, int32_t value) {
+    EmitOperation({ 0x69 }, Index(destination), source);
+    EmitImmediate32(value);
+  }
+
+  void Push(Register reg) {
+    if (Index(reg) >= 8) {
+      EmitByte(0x41);
+    }
+
+    EmitByte(0x50 + (Index(reg) & 7));
+  }
+
+  void Pop(Register reg) {
+    if (Index(reg) >= 8) {
+      EmitByte(0x41);
+    }
+
+    EmitByte(0x58 + (Index(reg) & 7));
+  }
+
+  void Ret() {
+    EmitByte(0xC3);
+  }
+
+  // Jumps return the position of their rel32 field, which is patched by PatchJump
+  size_t Jmp() {
+    EmitByte(0xE9);
+    EmitImmediate32(0);
+    return GetPosition() - 4;
+  }
+
+  size_t Jcc(Condition condition) {
+    EmitByte(0x0F);
+    EmitByte(0x80 + static_cast<uint8_t>(condition));
+    EmitImmediate32(0);
+    return GetPosition() - 4;
+  }
+
+  void PatchJump(size_t fieldPosition, size_t targetPosition) {
+    auto relative = static_cast<int32_t>(static_cast<int64_t>(targetPosition) - static_cast<int64_t>(fieldPosition + 4));
+    std::memcpy(m_code.data() + fieldPosition, &relative, sizeof(relative));
+  }
+
+private:
+  static uint8_t Index(Register reg) {
+    return static_cast<uint8_t>(reg);
+  }
+
+  void EmitByte(uint8_t byte) {
+    m_code.emplace_back(byte);
+  }
+
+  void EmitImmediate32(int32_t value) {
+    uint8_t bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    m_code.insert(m_code.end(), std::begin(bytes), std::end(bytes));
+  }
+
+  void EmitImmediate64(int64_t value) {
+    uint8_t bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    m_code.insert(m_code.end(), std::begin(bytes), std::end(bytes));
+  }
+
+  void EmitRex(bool isWide, uint8_t reg, uint8_t base) {
+    uint8_t rex = 0x40 | (isWide ? 0x08 : 0) | ((reg >> 3) << 2) | (base >> 3);
+    if (rex != 0x40) {
+      EmitByte(rex);
+    }
+  }
+
+  // REX.W opcode ModRM [SIB] [disp32]. reg is either a register index or an opcode extension
+  void EmitOperation(std::initializer_list<uint8_t> opcode, uint8_t reg, const Location& rm) {
+    uint8_t base = Index(rm.isRegister ? rm.reg : rm.base);
+    EmitRex(true, reg, base);
+    for (uint8_t byte : opcode) {
+      EmitByte(byte);
+    }
+
+    if (rm.isRegister) {
+      EmitByte(0xC0 | ((reg & 7) << 3) | (base & 7));
+      return;
+    }
+
+    EmitByte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == 4) {
+      // RSP and R12 need a SIB byte
+      EmitByte(0x24);
+    }
+
+    EmitImmediate32(rm.displacement);
+  }
+
+private:
+  std::vector<uint8_t> m_code;
+};
@@ -0,0 +1,325 @@
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "Compiler.hpp"
+#include "FunctionCompiler.hpp"
+#include "Interpreter.hpp"
+#include "Lexer.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+#include "Resolver.hpp"
+#include "VirtualMachine.hpp"
+
+// Runs generated programs on the tree interpreter and on every backend that compiles to native code,
+// optimized or not, with thresholds at 1 so everything that can be compiled is, and compares what
+// they print and how they fail. Programs come from a seeded generator, a failing seed reproduces
+// anywhere:
+//
+//   DifferentialTest [COUNT [FIRST_SEED]]
+//
+// The compiled backends run without limits, so one that loops where the reference stops hangs the
+// test instead, narrowing COUNT and FIRST_SEED finds the seed
+
+// The reference runs at most this many statements, programs that need more are skipped
+constexpr uint64_t kMaxStatements = 200000;
+
+// Deterministic on every standard library, unlike the distributions
+struct Generator final {
+  explicit Generator(uint64_t seed)
+  : m_random(seed) {
+  }
+
+  std::string Program() {
+    std::string program;
+    for (const char* variable : kVariables) {
+      if (Chance(95)) {
+        program += std::string(variable) + " = " + std::to_string(Range(-5, 5)) + '\n';
+      }
+    }
+
+    // r recurses in tail position until n runs out, so it only ever calls itself
+    program += "n = " + std::to_string(Range(0, 20)) + '\n';
+    program += "r function if $n != 0 then n sub 1 " + Simple(-1) + ' ' + Simple(-1) + " r()\n";
+    for (int function = 0; function < kFunctionCount; ++function) {
+      if (Chance(95)) {
+        program += std::string(kFunctions[function]) + " function " + Body(1, function) + '\n';
+      }
+    }
+
+    for (int64_t count = Range(3, 14); count > 0; --count) {
+      int64_t kind = Range(0, 99);
+      if (kind < 2) {
+        int function = static_cast<int>(Range(0, kFunctionCount - 1));
+        program += std::string(kFunctions[function]) + " function " + Body(1, function) + '\n';
+      } else if (kind < 10) {
+        program += "n = " + std::to_string(Range(0, 40)) + '\n';
+      } else if (kind < 50) {
+        program += Block(0, kFunctionCount) + '\n';
+      } else {
+        program += Simple(kFunctionCount) + '\n';
+      }
+    }
+
+    if (Chance(90)) {
+      program += "print\n";
+    }
+
+    return program;
+  }
+
+private:
+  static constexpr const char* kVariables[] = {"a", "b", "c"};
+  // Each calls only those after it, so nothing but r recurses
+  static constexpr const char* kFunctions[] = {"f", "g", "h"};
+  static constexpr int kFunctionCount = 3;
+
+  int64_t Range(int64_t min, int64_t max) {
+    return min + static_cast<int64_t>(m_random() % static_cast<uint64_t>(max - min + 1));
+  }
+
+  bool Chance(int64_t percent) {
+    return Range(0, 99) < percent;
+  }
+
+  std::string Variable() {
+    return kVariables[Range(0, 2)];
+  }
+
+  std::string Value() {
+    if (Chance(50)) {
+      return '$' + (Chance(10) ? std::string("n") : Variable());
+    }
+
+    static constexpr int64_t kConstants[] = {0, 1, 2, 3, -1, 5, 7, 10};
+    return std::to_string(Chance(80) ? kConstants[Range(0, 7)] : Range(-100, 100));
+  }
+
+  std::string Condition() {
+    std::string condition;
+    for (int64_t count = Range(1, 3); count > 0; --count) {
+      if (!condition.empty()) {
+        condition += Chance(50) ? " and " : " or ";
+      }
+
+      condition += Value() + (Chance(50) ? " == " : " != ") + Value();
+    }
+
+    return condition;
+  }
+
+  // caller is the index of the function it's in, kFunctionCount outside of them and -1 for no calls at all
+  std::string Simple(int caller) {
+    int64_t kind = Range(0, 99);
+    if ((kind < 75 || caller < 0) && Chance(85)) {
+      static constexpr const char* kOperators[] = {"=", "add", "sub", "mult", "=", "add"};
+      std::string op = kOperators[Range(0, 5)];
+      return Variable() + ' ' + op + ' ' + Value();
+    }
+
+    if (kind < 75 || caller < 0) {
+      return Updates();
+    }
+
+    if (kind < 78) {
+      return "delete " + Variable();
+    }
+
+    if (kind < 86) {
+      return "r()";
+    }
+
+    if (kind < 98) {
+      int first = caller == kFunctionCount ? 0 : caller + 1;
+      return first < kFunctionCount ? std::string(kFunctions[Range(first, kFunctionCount - 1)]) + "()" : "a add 1";
+    }
+
+    return "print";
+  }
+
+  // A few updates of one variable, often from itself or by nothing, which the optimizer fuses.
+  // Some follow a delete, so they have to fail on it
+  std::string Updates() {
+    static constexpr const char* kUpdates[] = {" = $", " add 0", " sub 0", " mult 1", " add 1", " mult 2", " = 3"};
+    std::string variable = Variable();
+    std::string updates = Chance(25) ? "delete " + variable : "";
+    for (int64_t count = Range(2, 3); count > 0; --count) {
+      std::string update = kUpdates[Range(0, 6)];
+      updates += (updates.empty() ? "" : " ") + variable + update + (update == " = $" ? variable : "");
+    }
+
+    return updates;
+  }
+
+  std::string Body(int depth, int caller) {
+    std::string body;
+    for (int64_t count = Range(1, 4); count > 0; --count) {
+      body += (body.empty() ? "" : " ") + Simple(caller);
+    }
+
+    if (depth < 2 && Chance(30)) {
+      body += ' ' + Block(depth + 1, caller);
+    }
+
+    return body;
+  }
+
+  std::string Block(int depth, int caller) {
+    if (Chance(50)) {
+      return "if " + Condition() + " then " + Body(depth, caller);
+    }
+
+    static constexpr const char* kCounts[] = {"3", "2", "0", "5", "-1", "10", "100"};
+    std::string count = Chance(25) ? '$' + Variable() : std::string(kCounts[Range(0, 6)]);
+    return "loop " + count + " do " + Body(depth, caller);
+  }
+
+private:
+  std::mt19937_64 m_random;
+};
+
+// What a run printed, then how it failed if it did
+struct Outcome final {
+  std::string output;
+  std::string error;
+
+  bool operator==(const Outcome&) const = default;
+};
+
+std::shared_ptr<AstNode> Parse(std::string_view source) {
+  Lexer lexer(source);
+  if (!lexer.Tokenize()) {
+    return nullptr;
+  }
+
+  return Parser(lexer.GetTokens()).Parse();
+}
+
+template <typename Func>
+Outcome Capture(Func run) {
+  Outcome outcome;
+  OutputSink output = OutputSink::ToString(outcome.output);
+  try {
+    run(output);
+  } catch (const std::exception& e) {
+    outcome.error = e.what();
+  }
+
+  output.Flush();
+  return outcome;
+}
+
+// Nullopt if it went over kMaxStatements
+std::optional<Outcome> RunReference(const std::string& source) {
+  std::shared_ptr<AstNode> program = Parse(source);
+  Resolver resolver;
+  resolver.Resolve(program.get());
+  InterpreterOptions options;
+  options.limits.maxStatements = kMaxStatements;
+  Interpreter interpreter(resolver.GetVariables(), resolver.GetFunctions(), options);
+  bool isOverLimit = false;
+  Outcome outcome = Capture([&](OutputSink& output) {
+    interpreter.SetOutput(output);
+    try {
+      interpreter.Evaluate(program.get());
+    } catch (const LimitExceededException&) {
+      isOverLimit = true;
+    }
+  });
+
+  if (isOverLimit) {
+    return std::nullopt;
+  }
+
+  return outcome;
+}
+
+Outcome RunJit(const std::string& source, bool optimize, CompilerOptions compilerOptions = {}) {
+  return Capture([&](OutputSink& output) {
+    std::shared_ptr<AstNode> program = Parse(source);
+    if (optimize) {
+      program = Optimizer().Optimize(program);
+    }
+
+    BytecodeProgram bytecode = Compiler(compilerOptions).Compile(program.get());
+    VirtualMachine machine(bytecode);
+    machine.SetOutput(output);
+    machine.EnableJit(JitOptions(1, 1));
+    machine.Run();
+  });
+}
+
+Outcome RunTiered(const std::string& source, bool optimize) {
+  return Capture([&](OutputSink& output) {
+    std::shared_ptr<AstNode> program = Parse(source);
+    std::optional<Optimizer> optimizer;
+    if (optimize) {
+      OptimizerOptions optimizerOptions;
+      optimizerOptions.deferFunctionBodies = true;
+      optimizer.emplace(optimizerOptions);
+      program = optimizer->Optimize(program);
+    }
+
+    Resolver resolver;
+    resolver.Resolve(program.get());
+    Interpreter interpreter(resolver.GetVariables(), resolver.GetFunctions());
+    std::optional<FunctionCompiler> functionCompiler;
+    if (optimizer) {
+      functionCompiler.emplace(std::move(*optimizer), resolver);
+      interpreter.SetFunctionCompiler(&*functionCompiler);
+    }
+
+    interpreter.SetOutput(output);
+    interpreter.EnableNativeTier(JitOptions(1, 1));
+    interpreter.Evaluate(program.get());
+  });
+}
+
+bool Check(uint64_t seed, const std::string& source, const Outcome& expected, std::string_view backend, const Outcome& actual) {
+  if (actual == expected) {
+    return true;
+  }
+
+  std::cout << "Seed " << seed << ", " << backend << " differs from the tree interpreter\n"
+    << source
+    << "Expected:\n" << expected.output << expected.error << '\n'
+    << "Got:\n" << actual.output << actual.error << "\n\n";
+  return false;
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+  uint64_t first = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
+  if (!Jit::kIsSupported) {
+    std::cout << "No JIT on this platform, comparing the bytecode VM and the tree interpreter only\n";
+  }
+
+  uint64_t skipped = 0;
+  uint64_t failed = 0;
+  for (uint64_t seed = first; seed < first + count; ++seed) {
+    std::string source = Generator(seed).Program();
+    std::optional<Outcome> expected = RunReference(source);
+    if (!expected) {
+      ++skipped;
+      continue;
+    }
+
+    CompilerOptions inlining;
+    inlining.inlineFunctions = true;
+    bool isPassed = Check(seed, source, *expected, "--jit", RunJit(source, false));
+    isPassed &= Check(seed, source, *expected, "-O --jit", RunJit(source, true));
+    isPassed &= Check(seed, source, *expected, "-O --jit --inline", RunJit(source, true, inlining));
+    isPassed &= Check(seed, source, *expected, "--tiered", RunTiered(source, false));
+    isPassed &= Check(seed, source, *expected, "-O --tiered", RunTiered(source, true));
+    failed += !isPassed;
+  }
+
+  std::cout << count - skipped - failed << " passed, " << failed << " failed, " << skipped << " skipped\n";
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Program.hpp"
+
+// Compiles a script once and runs it through the embedding API on a few threads at the same time,
+// each seeding its own environment and reading the results back, with and without optimize
+
+constexpr const char* kSource = R"(total = 0
+step function total add $n
+loop $n do step()
+square = $n
+square mult $n
+print
+)";
+
+constexpr int kThreadCount = 4;
+
+// Empty if the run went as expected, what went wrong otherwise
+std::string RunOnce(const Program& program, int64_t n) {
+  Environment environment(program);
+  if (!environment.Set("n", n)) {
+    return "n has no slot";
+  }
+
+  if (environment.Set("missing", 1)) {
+    return "missing has a slot";
+  }
+
+  std::string printed;
+  OutputSink output = OutputSink::ToString(printed);
+  Run(program, environment, output);
+  if (environment.Get("total") != n * n || environment.Get("square") != n * n) {
+    return "wrong results for n = " + std::to_string(n);
+  }
+
+  if (environment.Get("missing")) {
+    return "missing is defined";
+  }
+
+  if (printed.find("total = " + std::to_string(n * n) + '\n') == std::string::npos) {
+    return "wrong output for n = " + std::to_string(n) + ":\n" + printed;
+  }
+
+  return "";
+}
+
+int main() {
+  int failed = 0;
+  for (bool optimize : {false, true}) {
+    CompileOptions options;
+    options.optimize = optimize;
+    Program program = Compile(kSource, options);
+
+    std::vector<std::string> errors(kThreadCount);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreadCount; ++i) {
+      threads.emplace_back([&program, &errors, i] {
+        try {
+          for (int64_t n = 0; n < 50 && errors[i].empty(); ++n) {
+            errors[i] = RunOnce(program, n + i);
+          }
+        } catch (const std::exception& e) {
+          errors[i] = e.what();
+        }
+      });
+    }
+
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    for (const std::string& error : errors) {
+      if (!error.empty()) {
+        std::cout << (optimize ? "Optimized: " : "Unoptimized: ") << error << '\n';
+        ++failed;
+      }
+    }
+  }
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+# Runs CASE/program.txt with ARGS, a space separated list, and compares what it printed (the token
+# dump left out) with CASE/expected.txt. The exit code isn't checked, so a case may expect a failure
+#
+#   cmake -DPARSING=<Parsing> -DCASE=<dir> [-DARGS="-O --vm"] -P RunProgram.cmake
+
+separate_arguments(ARGS)
+execute_process(
+  COMMAND "${PARSING}" ${ARGS}
+  INPUT_FILE "${CASE}/program.txt"
+  OUTPUT_VARIABLE output
+  ERROR_QUIET
+)
+
+# Print never writes an empty line, the token dump ends with one
+string(FIND "${output}" "\n\n" end REVERSE)
+math(EXPR end "${end} + 2")
+string(SUBSTRING "${output}" ${end} -1 output)
+file(READ "${CASE}/expected.txt" expected)
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "Expected:\n${expected}Got:\n${output}")
+endif()
@@ -0,0 +1,39 @@
+# Runs CASE/prologue.txt to a snapshot, then CASE/program.txt from it with ARGS, and compares what
+# the second run printed (the token dump left out) with CASE/expected.txt
+#
+#   cmake -DPARSING=<Parsing> -DCASE=<dir> -DWORK=<dir> [-DARGS=-O] -P RunSnapshot.cmake
+
+# Tests of the same case with other ARGS may run in parallel
+get_filename_component(name "${CASE}" NAME)
+string(MAKE_C_IDENTIFIER "${name}${ARGS}" name)
+set(snapshot "${WORK}/${name}.snapshot")
+
+execute_process(
+  COMMAND "${PARSING}" --save-snapshot "${snapshot}"
+  INPUT_FILE "${CASE}/prologue.txt"
+  OUTPUT_QUIET
+  RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "Saving the snapshot failed with ${result}")
+endif()
+
+execute_process(
+  COMMAND "${PARSING}" ${ARGS} --load-snapshot "${snapshot}"
+  INPUT_FILE "${CASE}/program.txt"
+  OUTPUT_VARIABLE output
+  ERROR_QUIET
+  RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "Running from the snapshot failed with ${result}:\n${output}")
+endif()
+
+# Print never writes an empty line, the token dump ends with one
+string(FIND "${output}" "\n\n" end REVERSE)
+math(EXPR end "${end} + 2")
+string(SUBSTRING "${output}" ${end} -1 output)
+file(READ "${CASE}/expected.txt" expected)
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "Expected:\n${expected}Got:\n${output}")
+endif()